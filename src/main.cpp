@@ -3,7 +3,40 @@
 //
 // NOTE:
 //  - Assumes 32bpp XImage and VK_FORMAT_B8G8R8A8_UNORM swapchain.
-//  - No swapchain recreation on resize / OUT_OF_DATE, kept simple for clarity.
+//  - Swapchain is recreated with oldSwapchain on resize / OUT_OF_DATE; only
+//    display-sized resources are rebuilt, configure bursts are debounced.
+//  - Ctrl+Alt+G toggles frame generation; LSFL_FRAMEGEN=2|3|4|auto picks the
+//    multiplier. 2x uses FFX frame generation, 3x/4x our own warp kernel,
+//    auto follows source rate vs refresh and the measured GPU cost.
+//  - Ctrl+Alt+E (or LSFL_FRAMEGEN_MODE=extrapolate) switches frame generation
+//    to extrapolation: the newest frame is shown at once and followed by
+//    predicted ones, trading artefacts for no added latency.
+//  - LSFL_SCALER=spatial replaces FSR with a spatial filter that only
+//    redraws the output under 32x32 input tiles that changed;
+//    LSFL_SCALER=fused goes from staging to the swapchain in one dispatch
+//    (LSFL_SHARPNESS=0..1) when the swapchain supports storage.
+//  - Without frame generation, FSR writes the swapchain image directly when
+//    it supports storage (sRGB ones via VK_KHR_swapchain_mutable_format).
+//  - Letterbox / pillarbox bars are detected and cropped away before the
+//    upload (LSFL_LETTERBOX=0 turns this off).
+//  - LSFL_FOVEATE=center|pointer runs FSR on a region of interest only
+//    (LSFL_FOVEATE_SIZE, fraction per axis) over a bilinear periphery.
+//  - VRAM headroom is watched (VK_EXT_memory_budget); when it runs low the
+//    session drops frame generation, then render scale, then FSR for the
+//    spatial scaler (LSFL_VRAM_DEGRADE=0 only reports).
+//  - GPU time per stage (upload, downscale, motion, upscale, composite,
+//    framegen, output) is timestamped every frame; LSFL_GPU_PROFILE=1 logs
+//    min/avg/p99 now and then.
+//  - LSFL_TRACE=1 records CPU trace zones; Ctrl+Alt+T writes the last
+//    LSFL_TRACE_SECONDS as Chrome trace JSON (LSFL_TRACE_FILE) for Perfetto.
+//  - Ctrl+Alt+H (or LSFL_HUD=1) draws a performance HUD into the output:
+//    rates, CPU/GPU frame time, per-stage GPU time, capture-to-photon
+//    latency and a graph.
+//  - Frame time, source interval, capture, GPU and acquire-to-present
+//    histograms: p50/p90/p99/p99.9/max at session end and on Ctrl+Alt+P.
+//  - Capture-to-photon latency per source frame, from its XDamage stamp to
+//    the display time reported by VK_GOOGLE_display_timing or
+//    VK_KHR_present_wait (estimated from the present call without either).
 
 #define VK_USE_PLATFORM_XLIB_KHR
 
@@ -14,11 +47,14 @@
 #include <X11/extensions/Xcomposite.h> 
 #include <X11/Xatom.h>
 #include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xdamage.h>
 #include <X11/extensions/shape.h>
+#include <X11/extensions/Xrandr.h>
 #include <X11/keysym.h>
 
 
 #include <cassert>
+#include <cctype>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -27,14 +63,29 @@
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <numeric>
 #include <unistd.h>
 #include <chrono>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <initializer_list>
+#include <sys/stat.h>
+#include <poll.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <ffx_api/ffx_api.hpp>
 #include <ffx_api/ffx_api.h>
 #include <ffx_api/ffx_upscale.hpp>
 #include <ffx_api/vk/ffx_api_vk.hpp>
 #include <ffx_api/ffx_upscale.hpp>
+#include <ffx_api/ffx_framegeneration.hpp>
 
 
 static void fatal(const char* msg) {
@@ -49,6 +100,166 @@ static void vk_check(VkResult r, const char* what) {
     }
 }
 
+/* ---------------------------- Tracing ---------------------------- */
+
+// CPU trace zones. Each thread appends finished zones to its own ring, with
+// no locks on the way in; trace_dump() copies the rings out and writes the
+// recent part as Chrome trace JSON. Disabled, a zone costs a relaxed load;
+// -DLSFL_NO_TRACE compiles them out. A thread that exits hands its ring to
+// the next new thread, so short-lived workers (FSR init, one per session)
+// don't add a ring each.
+struct TraceEvent {
+    const char* name;    // string literal
+    uint64_t startNs;
+    uint64_t durNs;
+};
+
+struct TraceRing {
+    static constexpr uint64_t kSize = 1u << 15;   // ~13 s at 10 zones x 240 fps
+
+    TraceEvent events[kSize];
+    std::atomic<uint64_t> written{0};   // only the owning thread stores
+    uint32_t tid = 0;
+    const char* threadName = nullptr;
+};
+
+struct TraceState {
+    std::atomic<bool> enabled{false};                // LSFL_TRACE=1
+    double seconds = 10.0;                           // LSFL_TRACE_SECONDS
+    std::string path = "lsfl-trace.json";            // LSFL_TRACE_FILE
+    std::mutex mutex;                                // ring lists only
+    std::vector<std::unique_ptr<TraceRing>> rings;   // kept until exit
+    std::vector<TraceRing*> spare;                   // of exited threads
+};
+
+static TraceState g_trace;
+
+static uint64_t trace_now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Returns the thread's ring to g_trace.spare when the thread exits. A reused
+// ring keeps its tid and older zones; the new owner renames the track.
+struct TraceRingOwner {
+    TraceRing* ring = nullptr;
+
+    ~TraceRingOwner()
+    {
+        if (!ring) return;
+        std::lock_guard<std::mutex> lock(g_trace.mutex);
+        g_trace.spare.push_back(ring);
+    }
+};
+
+static TraceRing* trace_ring()
+{
+    thread_local TraceRingOwner owner;
+    if (!owner.ring) {
+        std::lock_guard<std::mutex> lock(g_trace.mutex);
+        if (!g_trace.spare.empty()) {
+            owner.ring = g_trace.spare.back();
+            g_trace.spare.pop_back();
+            owner.ring->threadName = nullptr;
+        } else {
+            g_trace.rings.push_back(std::make_unique<TraceRing>());
+            owner.ring = g_trace.rings.back().get();
+            owner.ring->tid = (uint32_t)g_trace.rings.size();
+        }
+    }
+    return owner.ring;
+}
+
+static void trace_thread_name(const char* name)
+{
+    if (g_trace.enabled.load(std::memory_order_relaxed)) trace_ring()->threadName = name;
+}
+
+struct TraceZone {
+    const char* name;
+    uint64_t start;
+
+    explicit TraceZone(const char* n)
+        : name(n), start(g_trace.enabled.load(std::memory_order_relaxed) ? trace_now_ns() : 0) {}
+
+    ~TraceZone()
+    {
+        if (!start) return;
+        TraceRing* r = trace_ring();
+        const uint64_t i = r->written.load(std::memory_order_relaxed);
+        r->events[i % TraceRing::kSize] = { name, start, trace_now_ns() - start };
+        r->written.store(i + 1, std::memory_order_release);
+    }
+};
+
+#ifndef LSFL_NO_TRACE
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#else
+#define TRACE_ZONE(name) ((void)0)
+#endif
+
+// Zones that started in the last g_trace.seconds, as Chrome trace events
+// (chrome://tracing, ui.perfetto.dev). Owners keep writing meanwhile, so
+// this reads like a seqlock: events[] is copied with plain loads, which can
+// tear an entry the owner is overwriting at that moment, and `written` read
+// again afterwards tells which entries may have been touched; those are
+// skipped. The torn copy is never used, so the race is benign in practice
+// (it is still a data race in the C++ memory model, as in any seqlock
+// without atomic payloads).
+static void trace_dump()
+{
+    if (!g_trace.enabled.load(std::memory_order_relaxed)) {
+        std::fprintf(stderr, "Tracing is off (LSFL_TRACE=1)\n");
+        return;
+    }
+    std::FILE* f = std::fopen(g_trace.path.c_str(), "w");
+    if (!f) {
+        std::fprintf(stderr, "Trace: cannot write %s\n", g_trace.path.c_str());
+        return;
+    }
+
+    const uint64_t now = trace_now_ns();
+    const uint64_t window = (uint64_t)(g_trace.seconds * 1e9);
+    const uint64_t from = now > window ? now - window : 0;
+    size_t zones = 0;
+
+    std::fprintf(f, "{\"traceEvents\":[\n");
+    std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"lsfl\"}}");
+
+    std::lock_guard<std::mutex> lock(g_trace.mutex);
+    std::vector<TraceEvent> copy;
+    for (const auto& r : g_trace.rings) {
+        if (r->threadName) {
+            std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                            "\"args\":{\"name\":\"%s\"}}", r->tid, r->threadName);
+        }
+
+        const uint64_t end = r->written.load(std::memory_order_acquire);
+        const uint64_t begin = end > TraceRing::kSize ? end - TraceRing::kSize : 0;
+        copy.clear();
+        for (uint64_t i = begin; i < end; ++i) copy.push_back(r->events[i % TraceRing::kSize]);
+
+        std::atomic_thread_fence(std::memory_order_acquire);   // copy before the re-read
+        const uint64_t after = r->written.load(std::memory_order_relaxed);
+        const uint64_t oldestIntact = after + 1 > TraceRing::kSize ? after + 1 - TraceRing::kSize : 0;
+        for (uint64_t i = std::max(begin, oldestIntact); i < end; ++i) {
+            const TraceEvent& e = copy[i - begin];
+            if (e.startNs < from) continue;
+            std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"dur\":%.3f}",
+                         e.name, r->tid, e.startNs / 1000.0, e.durNs / 1000.0);
+            ++zones;
+        }
+    }
+    std::fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    std::fclose(f);
+    std::printf("Trace: %zu zones from the last %.0f s written to %s\n",
+                zones, g_trace.seconds, g_trace.path.c_str());
+}
+
 /* ----------------------- X11 + XComposite ----------------------- */
 
 struct X11Context {
@@ -67,6 +278,10 @@ struct X11Context {
     // Output (fullscreen) size
     int outW = 0;
     int outH = 0;
+
+    // XDamage on the target tells us when the application drew a new frame
+    int damageEventBase = -1;  // -1: extension unavailable
+    Damage damage = 0;
 };
 
 void make_fullscreen(X11Context& xc);
@@ -173,11 +388,12 @@ void init_x11_copy(X11Context& xc)
     xc.capW = attrs.width;
     xc.capH = attrs.height;
 
-    // Output size (fullscreen)
-    xc.outW = DisplayWidth(xc.dpy, xc.screen);
-    xc.outH = DisplayHeight(xc.dpy, xc.screen);
-
     XCompositeRedirectWindow(xc.dpy, xc.targetWindow, CompositeRedirectAutomatic);
+
+    // One notify per batch of damage; re-armed with XDamageSubtract
+    if (xc.damageEventBase >= 0) {
+        xc.damage = XDamageCreate(xc.dpy, xc.targetWindow, XDamageReportNonEmpty);
+    }
     XSync(xc.dpy, False); // make errors happen here, not later
 
     // Name the window's pixmap. On a composited desktop, this refers to the
@@ -187,7 +403,51 @@ void init_x11_copy(X11Context& xc)
         fatal("XCompositeNameWindowPixmap returned 0");
     }
 
-    // Create an output window for Vulkan to present into
+    // The output window outlives sessions, it only gets mapped here
+    XMapWindow(xc.dpy, xc.vkWindow);
+    XFlush(xc.dpy);
+    make_fullscreen(xc);
+    setup_focus_on_target(xc);
+    // int resK = XGrabKeyboard(
+    //     xc.dpy,
+    //     xc.vkWindow,
+    //     True,
+    //     GrabModeAsync,
+    //     GrabModeAsync,
+    //     CurrentTime
+    // );
+    // if (resK != GrabSuccess)
+    //     std::fprintf(stderr, "XGrabKeyboard failed (%d)\n", resK);
+
+    // int resP = XGrabPointer(
+    //     xc.dpy,
+    //     xc.vkWindow,
+    //     True,
+    //     ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+    //     GrabModeAsync,
+    //     GrabModeAsync,
+    //     None,
+    //     None,
+    //     CurrentTime
+    // );
+    // if (resP != GrabSuccess)
+    //     std::fprintf(stderr, "XGrabPointer failed (%d)\n", resP);
+}
+
+// Create the (unmapped) output window for Vulkan to present into. It lives
+// for the whole application so the surface, device and swapchain can too.
+void init_x11_output(X11Context& xc)
+{
+    int damageError = 0;
+    if (!XDamageQueryExtension(xc.dpy, &xc.damageEventBase, &damageError)) {
+        std::fprintf(stderr, "XDamage not available, source rate follows the capture loop\n");
+        xc.damageEventBase = -1;
+    }
+
+    // Output size (fullscreen)
+    xc.outW = DisplayWidth(xc.dpy, xc.screen);
+    xc.outH = DisplayHeight(xc.dpy, xc.screen);
+
     XSetWindowAttributes a{};
     a.override_redirect = True;  // <- key: WM won't manage/focus it
     a.event_mask = ExposureMask | StructureNotifyMask;
@@ -219,38 +479,537 @@ void init_x11_copy(X11Context& xc)
     // XSelectInput(xc.dpy, xc.vkWindow,
     //          ExposureMask |
     //          StructureNotifyMask);
-    XMapWindow(xc.dpy, xc.vkWindow);
     XFlush(xc.dpy);
-    make_fullscreen(xc);
-    setup_focus_on_target(xc);
-    // int resK = XGrabKeyboard(
-    //     xc.dpy,
-    //     xc.vkWindow,
-    //     True,
-    //     GrabModeAsync,
-    //     GrabModeAsync,
-    //     CurrentTime
-    // );
-    // if (resK != GrabSuccess)
-    //     std::fprintf(stderr, "XGrabKeyboard failed (%d)\n", resK);
+}
 
-    // int resP = XGrabPointer(
-    //     xc.dpy,
-    //     xc.vkWindow,
-    //     True,
-    //     ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-    //     GrabModeAsync,
-    //     GrabModeAsync,
-    //     None,
-    //     None,
-    //     CurrentTime
-    // );
-    // if (resP != GrabSuccess)
-    //     std::fprintf(stderr, "XGrabPointer failed (%d)\n", resP);
+/* ----------------------- Frame statistics ----------------------- */
+
+// Log-linear histogram of durations (HDR histogram style): microseconds,
+// exact below 64 us, then 32 buckets per power of two, so any value is
+// within ~3% of its bucket. Fixed size, recording is a few integer ops.
+struct LatencyHistogram {
+    static constexpr uint32_t kSubBits = 5;
+    static constexpr uint32_t kSub = 1u << kSubBits;
+    static constexpr uint32_t kBuckets = 1024;   // up to ~18 hours
+
+    uint32_t counts[kBuckets] = {};
+    uint64_t count = 0;
+    uint64_t maxUs = 0;
+};
+
+static uint32_t histogram_bucket(uint64_t us)
+{
+    if (us < 2 * LatencyHistogram::kSub) return (uint32_t)us;
+    const uint32_t msb = 63u - (uint32_t)__builtin_clzll(us);
+    const uint32_t shift = msb - LatencyHistogram::kSubBits;
+    const uint32_t index = (shift + 1) * LatencyHistogram::kSub +
+                           (uint32_t)(us >> shift) - LatencyHistogram::kSub;
+    return std::min(index, LatencyHistogram::kBuckets - 1);
+}
+
+// Largest value that lands in `index`
+static uint64_t histogram_bucket_top(uint32_t index)
+{
+    if (index < 2 * LatencyHistogram::kSub) return index;
+    const uint32_t shift = index / LatencyHistogram::kSub - 1;
+    const uint64_t sub = index % LatencyHistogram::kSub + LatencyHistogram::kSub;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_record(LatencyHistogram& h, double ms)
+{
+    const uint64_t us = ms > 0.0 ? (uint64_t)(ms * 1000.0 + 0.5) : 0;
+    ++h.counts[histogram_bucket(us)];
+    ++h.count;
+    h.maxUs = std::max(h.maxUs, us);
+}
+
+// q in [0, 1]; the top of the bucket holding that rank, in ms
+double histogram_percentile(const LatencyHistogram& h, double q)
+{
+    if (!h.count) return 0.0;
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * (double)h.count));
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+        seen += h.counts[i];
+        if (seen >= rank) return std::min(histogram_bucket_top(i), h.maxUs) / 1000.0;
+    }
+    return h.maxUs / 1000.0;
+}
+
+// Per session, reset when one starts
+struct FrameStats {
+    LatencyHistogram frameTime;        // main loop, present to present
+    LatencyHistogram sourceInterval;   // application frames (XDamage stamps)
+    LatencyHistogram capture;          // XSync + XGetImage
+    LatencyHistogram gpu;              // whole submissions (GpuStage::Submission)
+    LatencyHistogram acquireToPresent; // acquire call to present returning
+    LatencyHistogram captureToPhoton;  // source change to on screen (PhotonLatency)
+    const char* photonClock = "estimated";
+    uint64_t photonImprecise = 0;      // in captureToPhoton but vague (PhotonLatency::kImpreciseMs)
+    uint64_t photonLost = 0;           // not in captureToPhoton
+};
+
+void frame_stats_print(const FrameStats& st, const char* when)
+{
+    const std::pair<const char*, const LatencyHistogram*> rows[] = {
+        { "frame time",         &st.frameTime },
+        { "source interval",    &st.sourceInterval },
+        { "capture",            &st.capture },
+        { "gpu",                &st.gpu },
+        { "acquire to present", &st.acquireToPresent },
+        { "capture to photon",  &st.captureToPhoton },
+    };
+    std::printf("Frame stats (%s), ms, photon times %s:\n", when, st.photonClock);
+    for (const auto& row : rows) {
+        const LatencyHistogram& h = *row.second;
+        std::printf("  %-18s n=%-8llu p50 %7.2f  p90 %7.2f  p99 %7.2f  p99.9 %7.2f  max %7.2f\n",
+                    row.first, (unsigned long long)h.count,
+                    histogram_percentile(h, 0.50), histogram_percentile(h, 0.90),
+                    histogram_percentile(h, 0.99), histogram_percentile(h, 0.999),
+                    h.maxUs / 1000.0);
+    }
+    if (st.photonImprecise || st.photonLost) {
+        std::printf("  capture to photon: %llu of them imprecise, %llu presents never resolved\n",
+                    (unsigned long long)st.photonImprecise, (unsigned long long)st.photonLost);
+    }
+}
+
+/* ------------------------ Source cadence ------------------------ */
+
+// Timing of the captured application's own frames, from XDamage server
+// timestamps (or our loop when XDamage is missing). Median and median
+// absolute deviation over a short window, so a hitch or a burst of
+// coalesced damage doesn't drag the estimate around.
+struct SourceClock {
+    static constexpr size_t kWindow = 32;
+    static constexpr double kMaxIntervalMs = 250.0;   // longer = paused, not a frame rate
+    static constexpr double kCoalesceMs = 1.0;        // same frame, several notifies
+
+    double intervals[kWindow] = {};
+    size_t count = 0;
+    size_t next = 0;
+
+    double lastStampMs = -1.0;
+    double lastIntervalMs = 1000.0 / 60.0;
+    double intervalMs = 1000.0 / 60.0;   // median
+    double jitterMs = 0.0;               // MAD
+    double reportedIntervalMs = 0.0;
+
+    uint64_t frames = 0;      // genuine new source frames
+    uint64_t duplicates = 0;  // captures identical to the previous one
+    bool pending = true;      // damage not yet captured
+    double pendingStampMs = -1.0;  // first damage since the last capture
+};
+
+void source_clock_reset(SourceClock& sc)
+{
+    sc = SourceClock{};
+}
+
+static double median_of(double* v, size_t n)
+{
+    std::nth_element(v, v + n / 2, v + n);
+    return v[n / 2];
+}
+
+// Damage reported at stampMs; the frame only counts once its capture
+// turns out to differ from the previous one (source_clock_tick)
+void source_clock_damage(SourceClock& sc, double stampMs)
+{
+    if (!sc.pending || sc.pendingStampMs < 0.0) sc.pendingStampMs = stampMs;
+    sc.pending = true;
+}
+
+// Records a new source frame at stampMs (< 0: time unknown, only counted),
+// and its interval into `intervals` when given. Returns false if it was
+// folded into the previous one.
+bool source_clock_tick(SourceClock& sc, double stampMs, LatencyHistogram* intervals = nullptr)
+{
+    if (stampMs < 0.0) {
+        sc.frames++;
+        return true;
+    }
+    if (sc.lastStampMs >= 0.0) {
+        double dt = stampMs - sc.lastStampMs;
+        if (dt < SourceClock::kCoalesceMs) return false;
+
+        if (dt <= SourceClock::kMaxIntervalMs) {
+            if (intervals) histogram_record(*intervals, dt);
+            sc.lastIntervalMs = dt;
+            sc.intervals[sc.next] = dt;
+            sc.next = (sc.next + 1) % SourceClock::kWindow;
+            sc.count = std::min(sc.count + 1, SourceClock::kWindow);
+
+            double tmp[SourceClock::kWindow];
+            std::copy(sc.intervals, sc.intervals + sc.count, tmp);
+            sc.intervalMs = median_of(tmp, sc.count);
+            for (size_t i = 0; i < sc.count; ++i) {
+                tmp[i] = std::fabs(sc.intervals[i] - sc.intervalMs);
+            }
+            sc.jitterMs = median_of(tmp, sc.count);
+        } else {
+            // Resuming after a pause: the gap says nothing about the rate
+            sc.lastIntervalMs = sc.intervalMs;
+        }
+    }
+    sc.lastStampMs = stampMs;
+    sc.frames++;
+
+    if (sc.count >= 8 &&
+        std::fabs(sc.intervalMs - sc.reportedIntervalMs) > 0.05 * sc.intervalMs) {
+        sc.reportedIntervalMs = sc.intervalMs;
+        std::printf("Source: %.1f fps (jitter %.2f ms, %llu duplicates dropped)\n",
+                    1000.0 / sc.intervalMs, sc.jitterMs, (unsigned long long)sc.duplicates);
+    }
+    return true;
+}
+
+// Frame time for the upscaler: the real gap unless it was an outlier
+float source_clock_frame_delta(const SourceClock& sc)
+{
+    double dt = sc.lastIntervalMs;
+    if (std::fabs(dt - sc.intervalMs) > 4.0 * sc.jitterMs + 2.0) dt = sc.intervalMs;
+    return (float)(dt / 1000.0);
+}
+
+// Sleeps until the X connection has something to read or timeoutMs passes
+static void wait_for_x_events(const X11Context& xc, int timeoutMs)
+{
+    if (XPending(xc.dpy)) return;
+    pollfd pfd{ ConnectionNumber(xc.dpy), POLLIN, 0 };
+    poll(&pfd, 1, timeoutMs);
 }
 
 /* ---------------------------- Vulkan ---------------------------- */
 
+// One compute pipeline with its own descriptor set layout; binding i has the
+// i-th type given to create_compute_pass().
+struct ComputePass {
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> sets;
+};
+
+// Device memory comes out of shared blocks (see "GPU memory"): an
+// allocation is a range of one. The strategy is the caller's hint; small
+// and large requests are routed to Pool and Whole regardless.
+enum class AllocStrategy : uint8_t {
+    Buddy,       // general purpose: power-of-two ranges, merged again on free
+    Linear,      // freed together: bump pointer, the block resets once empty
+    Pool,        // small requests: fixed-size slots
+    Whole,       // large requests: one per block, recycled for a similar size
+    Dedicated    // the driver asked for it: freed with the resource
+};
+
+struct GpuAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize   offset = 0;
+    VkDeviceSize   size = 0;     // reserved, rounded up
+    int32_t        block = -1;   // into GpuAllocator::blocks
+    explicit operator bool() const { return memory != VK_NULL_HANDLE; }
+};
+
+struct GpuBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t typeIndex = 0;
+    AllocStrategy strategy = AllocStrategy::Buddy;
+    bool forImages = false;    // buffers and optimal images never share a block
+    uint32_t live = 0;         // allocations in it
+    void* mapped = nullptr;    // host-visible blocks, mapped on first use
+
+    VkDeviceSize head = 0;                                // Linear
+    std::vector<VkDeviceSize> freeSlots;                  // Pool
+    std::vector<std::vector<VkDeviceSize>> freeRanges;    // Buddy, per order
+};
+
+struct GpuAllocator {
+    static constexpr VkDeviceSize kBlockSize  = 64ull << 20;       // buddy and linear
+    static constexpr VkDeviceSize kMinRange   = 4ull << 10;        // buddy order 0
+    static constexpr VkDeviceSize kWholeAbove = kBlockSize / 4;
+    static constexpr VkDeviceSize kPoolSlot   = 64ull << 10;
+    static constexpr VkDeviceSize kPoolBlock  = 4ull << 20;
+    static constexpr VkDeviceSize kSpareLimit = 256ull << 20;      // empty blocks kept
+
+    VkPhysicalDeviceMemoryProperties memProps{};   // queried once
+    std::vector<GpuBlock> blocks;                  // freed ones have no memory
+    VkDeviceSize reserved = 0;       // live VkDeviceMemory
+    VkDeviceSize used = 0;           // handed out
+    VkDeviceSize peakReserved = 0;
+    VkDeviceSize heapReserved[VK_MAX_MEMORY_HEAPS]{};   // reserved, per heap
+    uint32_t deviceAllocations = 0;  // vkAllocateMemory calls
+};
+
+// VRAM headroom, from VK_EXT_memory_budget when the driver has it, else a
+// share of the heap against what we hold ourselves. Checked about once a
+// second; when a device-local heap runs short the session steps down one
+// notch at a time and stays there.
+struct MemoryBudget {
+    static constexpr double kLowHeadroom = 0.10;   // of the heap's budget
+    static constexpr int kSettleSeconds = 3;       // between steps, for usage to catch up
+    static constexpr float kMinRenderScale = 0.5f;
+
+    bool supported = false;    // device extension enabled
+    bool degrade = true;       // LSFL_VRAM_DEGRADE=0: report only
+    bool exhausted = false;    // nothing left to give up, warned
+    bool framegenDropped = false;  // first step taken: Ctrl+Alt+G can't undo it
+    uint32_t heapCount = 0;
+    VkDeviceSize budget[VK_MAX_MEMORY_HEAPS]{};
+    VkDeviceSize usage[VK_MAX_MEMORY_HEAPS]{};     // whole process: ours, FFX, swapchain
+    std::chrono::steady_clock::time_point nextCheck{};
+};
+
+// Hierarchical block-matching motion estimator. Luma pyramids ping-pong
+// between frames, so the previous frame's pyramid is reused as-is and only
+// one new pyramid is built per frame. Images are render-sized (per session),
+// pipelines and descriptor sets live with the device.
+struct MotionEstimatorParams {
+    int blockSize    = 8;   // 4, 8 or 16 (workgroup is blockSize^2)
+    int searchRadius = 4;   // per level, in pixels of that level
+    int levels       = 4;   // reach is about searchRadius << (levels - 1)
+};
+
+struct PyramidLevel {
+    VkImage        image = VK_NULL_HANDLE;
+    GpuAllocation  memory;
+    VkImageView    view = VK_NULL_HANDLE;
+    VkExtent2D     extent{0,0};
+};
+
+struct MotionEstimator {
+    MotionEstimatorParams params;
+
+    ComputePass downsamplePass;   // set [pyramid * params.levels + level]
+    ComputePass searchPass;       // set [pyramid * params.levels + level]
+
+    std::vector<PyramidLevel> luma[2];
+    std::vector<PyramidLevel> vectors;  // per level; level 0 is motionVectorImage
+
+    uint32_t levelCount = 0;      // this session, <= params.levels
+    uint32_t current = 0;         // pyramid the next frame is written to
+    bool historyValid = false;    // luma[current ^ 1] holds the previous frame
+    bool layoutsReady = false;    // pyramid images are kept in GENERAL
+};
+
+// LSFL_SCALER=spatial: no temporal upscaler. A diff pass lists the input
+// tiles that changed since the last frame and the filter is dispatched
+// indirectly over just those, into an output that persists across frames.
+struct SpatialScaler {
+    static constexpr uint32_t kTile = 32;   // input pixels, matches tile_diff.comp
+
+    bool enabled = false;
+    bool fused = false;        // staging -> swapchain in one dispatch, where possible
+    float sharpness = 0.25f;   // fused kernel, 0..1
+
+    ComputePass diffPass;      // input, history -> tile list
+    ComputePass upscalePass;   // input, tile list -> outputColorImage
+    ComputePass fusedPass;     // staging buffer -> swapchain image
+
+    VkImage        historyImage = VK_NULL_HANDLE;   // render-sized RGBA8 copy, GENERAL
+    GpuAllocation  historyMemory;
+    VkImageView    historyView = VK_NULL_HANDLE;
+
+    VkBuffer       tileBuffer = VK_NULL_HANDLE;     // VkDispatchIndirectCommand + pad, then tiles
+    GpuAllocation  tileMemory;
+    uint32_t tilesX = 0;
+    uint32_t tilesY = 0;
+
+    bool outputValid = false;  // history and outputColorImage match the last frame
+};
+
+// LSFL_FOVEATE=center|pointer: FSR only runs on a region of interest; the
+// periphery is a bilinear stretch of the input, blended in across a
+// feathered border by foveate_composite.comp.
+struct Foveation {
+    enum class Mode { Off, Center, Pointer };
+
+    Mode  mode = Mode::Off;
+    float size = 0.5f;        // ROI per axis, fraction of the picture
+    int   feather = 48;       // display pixels
+
+    ComputePass compositePass;
+
+    // ROI copies of FSR's inputs and its output, at their origin; sized for
+    // the largest ROI the session can ask for
+    VkImage        colorImage = VK_NULL_HANDLE;
+    GpuAllocation  colorMemory;
+    VkImageView    colorView = VK_NULL_HANDLE;
+    VkImage        motionImage = VK_NULL_HANDLE;
+    GpuAllocation  motionMemory;
+    VkImageView    motionView = VK_NULL_HANDLE;
+    VkImage        outputImage = VK_NULL_HANDLE;
+    GpuAllocation  outputMemory;
+    VkImageView    outputView = VK_NULL_HANDLE;
+    VkExtent2D renderCapacity{0,0};
+    VkExtent2D displayCapacity{0,0};
+
+    VkRect2D renderRoi{};     // in the active render area
+    VkRect2D displayRoi{};    // in displayRect, relative to its origin
+    bool active = false;      // this frame's FSR dispatch covers the ROI only
+
+    // GPU cost comes from the profiler (Upscale and Composite stages)
+    double roiFraction = 0.0;
+    uint32_t samples = 0;
+};
+
+// Per-stage GPU time. Every submission gets a slot in a ring of timestamp
+// queries: one at the start, then one at the end of each stage it runs, a
+// stage's time running from the previous mark. Slots are read back after
+// later fence waits without waiting on the queries themselves, and summed
+// per stage into a rolling window of samples (gpu_profile_stats).
+// Submission is never marked: it is the whole submission, start to last mark.
+// Composite is the foveation blend; Upscale is then FSR on the ROI only.
+enum class GpuStage : uint32_t {
+    Upload, Downscale, Motion, Upscale, Composite, FrameGen, Output, Submission, Count
+};
+
+static const char* const kGpuStageNames[] = {
+    "upload", "downscale", "motion", "upscale", "composite", "framegen", "output", "total"
+};
+
+struct GpuStageStats {
+    float minMs = 0.0f;
+    float avgMs = 0.0f;
+    float p99Ms = 0.0f;
+    uint32_t samples = 0;
+};
+
+struct GpuProfiler {
+    static constexpr uint32_t kStages = (uint32_t)GpuStage::Count;
+    static constexpr uint32_t kSlots  = 8;     // submissions in flight or unread
+    static constexpr uint32_t kMarks  = 12;    // timestamps per submission
+    static constexpr uint32_t kWindow = 256;   // samples per stage
+
+    struct Slot {
+        uint32_t marks = 0;          // timestamps written, the first is the start
+        GpuStage stage[kMarks]{};    // stage ended by mark i, i >= 1
+        bool pending = false;        // recorded, not read back yet
+        bool followup = false;       // a later submission of a generated group
+    };
+
+    VkQueryPool pool = VK_NULL_HANDLE;
+    float timestampPeriod = 0.0f;    // ns per tick
+    uint64_t tickMask = ~0ull;       // timestampValidBits of the queue
+    bool log = false;                // LSFL_GPU_PROFILE=1
+    Slot slots[kSlots];
+    uint32_t next = 0;
+    int32_t recording = -1;          // slot of the command buffer being recorded
+
+    float window[kStages][kWindow]{};   // ms, a ring per stage
+    uint32_t head[kStages]{};
+    uint32_t count[kStages]{};
+    uint32_t sinceReport = 0;        // submissions read back
+
+    // Smoothed, for the adaptive frame multiplier: a real frame's whole
+    // submission, and a followup that generated a frame
+    float frameMs = 0.0f;
+    float generatedMs = 0.0f;
+};
+
+// Ctrl+Alt+H / LSFL_HUD=1: rates, frame times and per-stage GPU time as text
+// over a frame-time graph, drawn into the presented image by hud_overlay.comp
+// (storage swapchain images only). The text is laid out about four times a
+// second from the counters below; the graph gets every present.
+struct Hud {
+    static constexpr uint32_t kCols   = 40;    // match hud_overlay.comp
+    static constexpr uint32_t kRows   = 5;
+    static constexpr uint32_t kGraph  = 120;
+    static constexpr uint32_t kPanelW = 8 + kCols * 6;                 // units
+    static constexpr uint32_t kPanelH = 8 + kRows * 9 + 40 + 4;
+
+    struct Data {                      // the shader's std430 buffer
+        char  text[kRows][kCols];
+        float graph[kGraph];
+    };
+
+    bool enabled = false;
+    ComputePass pass;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    GpuAllocation memory;
+    Data* data = nullptr;              // mapped; written after the frame fence only
+
+    float graph[kGraph] = {};          // present-to-present ms, a ring
+    uint32_t graphHead = 0;            // oldest
+    uint32_t graphCount = 0;           // filled slots, from index 0 until it wraps
+    uint32_t dataHead = 0;             // graphHead when data->graph was written
+    float budgetMs = 1000.0f / 60.0f;  // refresh interval
+
+    std::chrono::steady_clock::time_point lastPresent{};
+    std::chrono::steady_clock::time_point windowStart{};
+    uint32_t presents = 0;
+    uint32_t generated = 0;
+    uint32_t frames = 0;
+    double cpuMs = 0.0;
+    uint32_t latencies = 0;            // capture-to-photon samples this window
+    double latencySumMs = 0.0;
+    double latencyMs = 0.0;            // shown: the last window that had any
+};
+
+// Capture-to-photon latency: the present that puts a source frame on screen
+// is tagged with when the frame changed, and its display time is looked up
+// once the driver knows it. Display timing answers without blocking, after
+// the frame fence. present_wait only says a present is done, so a thread
+// polls for each one and takes the time it is first seen done.
+struct PhotonLatency {
+    enum class Method { Estimate, PresentWait, DisplayTiming };
+    static constexpr uint32_t kPending = 16;
+    static constexpr auto kPollInterval = std::chrono::microseconds(500);
+    static constexpr uint64_t kAcquireSliceNs = 1000000;  // main thread, while the waiter runs
+    static constexpr double kImpreciseMs = 1.0;          // present-wait samples vaguer than this are counted
+
+    struct Pending {
+        uint64_t id = 0;
+        std::chrono::steady_clock::time_point origin{};
+        std::chrono::steady_clock::time_point since{};  // known not shown yet until then
+    };
+
+    Method method = Method::Estimate;
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+    PFN_vkGetPastPresentationTimingGOOGLE pastTiming = nullptr;
+
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;   // the pending presents went to
+    Pending pending[kPending];                   // a ring, oldest at head
+    uint32_t head = 0;
+    uint32_t count = 0;
+    uint64_t nextId = 1;                         // present IDs only grow
+
+    // Present-wait thread. vkWaitForPresentKHR needs the swapchain externally
+    // synchronized: it polls with a zero timeout under swapchainMutex, which
+    // the main thread takes around its own swapchain calls (swapchain_lock),
+    // and sleeps between polls without it. `mutex` guards the ring above and
+    // the results.
+    std::thread waiter;
+    std::mutex mutex;
+    std::mutex swapchainMutex;
+    std::condition_variable wake;
+    bool stop = false;
+    float resolvedMs[kPending];
+    uint32_t resolvedCount = 0;
+    uint32_t imprecise = 0;    // resolved, but only to more than kImpreciseMs
+    uint32_t lost = 0;         // tagged presents that never got a time
+};
+
+// For main-thread calls on the swapchain while the present-wait thread runs
+std::unique_lock<std::mutex> swapchain_lock(PhotonLatency& pl)
+{
+    if (!pl.waiter.joinable()) return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(pl.swapchainMutex);
+}
+
+// Pending presents went to the old swapchain, which is about to be retired;
+// called with swapchain_lock held so the waiter isn't in the old one
+void photon_set_swapchain(PhotonLatency& pl, VkSwapchainKHR swapchain)
+{
+    std::lock_guard<std::mutex> lock(pl.mutex);
+    pl.swapchain = swapchain;
+    pl.lost += pl.count;
+    pl.head = 0;
+    pl.count = 0;
+}
+
 struct VulkanContext {
     VkInstance instance = VK_NULL_HANDLE;
     VkPhysicalDevice physDevice = VK_NULL_HANDLE;
@@ -258,52 +1017,169 @@ struct VulkanContext {
     uint32_t queueFamilyIndex = 0;
     VkQueue queue = VK_NULL_HANDLE;
 
+    // Shared by every pipeline we (and FFX, see ffx_get_device_proc_addr) create
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    bool pipelineCacheWarm = false;    // loaded valid data from disk
+
     VkSurfaceKHR surface = VK_NULL_HANDLE;
     VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkSwapchainKHR retiredSwapchain = VK_NULL_HANDLE; // passed as oldSwapchain, see release_retired_swapchain
+    uint32_t retiredPresents = 0;                      // presents on swapchain since it was retired
     VkFormat swapchainFormat = VK_FORMAT_B8G8R8A8_UNORM;
     VkExtent2D swapExtent{0,0};
     std::vector<VkImage> swapImages;
 
+    // Storage views of the swapchain images: the upscaler writes them
+    // directly instead of copying outputColorImage over. An sRGB swapchain
+    // gets UNORM views (VK_KHR_swapchain_mutable_format), same bytes.
+    bool swapMutableFormat = false;   // device extension enabled
+    bool swapStorage = false;
+    // Our kernels writing BGRA8 / swapchain images declare no format: without
+    // shaderStorageImageWriteWithoutFormat there is no own frame generation,
+    // spatial scaler, foveation or HUD
+    bool storageWriteWithoutFormat = false;
+    VkFormat swapViewFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    std::vector<VkImageView> swapViews;
+    std::vector<VkImageView> retiredSwapViews;   // go with retiredSwapchain
+
     VkCommandPool cmdPool = VK_NULL_HANDLE;
     std::vector<VkCommandBuffer> cmdBuffers;
 
+    GpuAllocator allocator;
+    MemoryBudget budget;
+    GpuProfiler profiler;
+    Hud hud;
+    FrameStats stats;
+    PhotonLatency photon;
+
     VkSemaphore imageAvailable = VK_NULL_HANDLE;
     VkSemaphore renderFinished = VK_NULL_HANDLE;
     VkFence inFlight = VK_NULL_HANDLE;
 
     // Staging buffer for upload
     VkBuffer stagingBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+    GpuAllocation stagingMemory;
     VkDeviceSize stagingSize = 0;
 
     VkExtent2D renderExtent;   // low-res input to FSR
+    float renderScale = 1.0f;  // of the capture, lowered when VRAM runs short
     VkExtent2D displayExtent;  // swapchain / window size
     VkExtent2D captureExtent{0,0};
 
+    // Letterbox crop: the part of the capture that isn't black bars, kept at
+    // the origin of every image from staging on, and where it lands on the
+    // display. Both cover everything when nothing is cropped.
+    VkRect2D activeRect{};     // capture space
+    VkRect2D displayRect{};    // display space
+
     // NEW: off-screen input color image at render resolution
     VkImage        inputColorImage = VK_NULL_HANDLE;
-    VkDeviceMemory inputColorMemory = VK_NULL_HANDLE;
+    GpuAllocation  inputColorMemory;
     VkImageView    inputColorView = VK_NULL_HANDLE;
+    VkImageLayout  inputColorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
     // NEW: motion-vector image (R16G16_SFLOAT)
     VkImage        motionVectorImage = VK_NULL_HANDLE;
-    VkDeviceMemory motionVectorMemory = VK_NULL_HANDLE;
+    GpuAllocation  motionVectorMemory;
     VkImageView    motionVectorView = VK_NULL_HANDLE;
+    VkImageLayout  motionVectorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // Compute passes (app scope) and the sampler they read inputs with
+    VkSampler      pointSampler = VK_NULL_HANDLE;
+    VkSampler      linearSampler = VK_NULL_HANDLE;
+    MotionEstimator motion;
+    SpatialScaler  spatial;
+    Foveation      foveation;
+    ComputePass    interpolatePass;
+    ComputePass    extrapolatePass;
 
     // Add to VulkanContext (next to your existing images)
     VkImage        outputColorImage = VK_NULL_HANDLE;
-    VkDeviceMemory outputColorMemory = VK_NULL_HANDLE;
+    GpuAllocation  outputColorMemory;
     VkImageView    outputColorView = VK_NULL_HANDLE;
 
+    // Frame generation target, display-sized, only allocated while FG is in use
+    VkImage        interpolatedColorImage = VK_NULL_HANDLE;
+    GpuAllocation  interpolatedColorMemory;
+    VkImageView    interpolatedColorView = VK_NULL_HANDLE;
+
+    // Previous real output, t = 0 for the interpolate kernel
+    VkImage        prevOutputColorImage = VK_NULL_HANDLE;
+    GpuAllocation  prevOutputColorMemory;
+    VkImageView    prevOutputColorView = VK_NULL_HANDLE;
+    VkImageLayout  prevOutputColorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // FSR only, constant: cleared once on first use
     VkImage        depthImage = VK_NULL_HANDLE;
-    VkDeviceMemory depthMemory = VK_NULL_HANDLE;
+    GpuAllocation  depthMemory;
     VkImageView    depthView = VK_NULL_HANDLE;
+    VkImageLayout  depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
+    // Full-res upload target, only when the render extent differs from the
+    // capture (otherwise staging goes straight into inputColorImage).
+    // Transient: its contents never outlive the frame.
     VkImage        captureColorImage  = VK_NULL_HANDLE;
-    VkDeviceMemory captureColorMemory = VK_NULL_HANDLE;
+    GpuAllocation  captureColorMemory;
     VkImageView    captureColorView = VK_NULL_HANDLE;
 };
 
+// FFX context creation compiles and creates dozens of pipelines, which costs
+// hundreds of milliseconds. Contexts that go idle are parked here, keyed by
+// what they were created for, and handed out again instead of a fresh one.
+struct FSRContextKey {
+    FfxApiDimensions2D maxRenderSize{0,0};
+    FfxApiDimensions2D maxUpscaleSize{0,0};
+    uint32_t flags = 0;
+};
+
+struct FSRContextCache {
+    struct Entry {
+        FSRContextKey key;
+        ffx::Context context = nullptr;
+        uint64_t lastUse = 0;
+    };
+    std::vector<Entry> entries;
+    size_t capacity = 3;      // each context holds display-sized internal targets
+    uint64_t useClock = 0;
+};
+
+// Cold context creation runs on a worker thread while frames go out through
+// the blit path. The result is parked in the cache by the main thread.
+struct FSRAsyncInit {
+    std::thread worker;
+    std::atomic<bool> done{false};
+    FSRContextKey key;
+    ffx::Context context = nullptr;
+};
+
+// FFX frame generation driven without the FFX swapchain: we dispatch it on
+// our own command buffer and present the generated frame ourselves.
+struct FrameGenState {
+    ffx::Context context = nullptr;
+    FfxApiDimensions2D displaySize{0,0};
+    FfxApiDimensions2D maxRenderSize{0,0};
+
+    bool enabled = false;        // user toggle
+    bool resetHistory = true;    // next dispatch has no previous frame to blend with
+    uint64_t frameID = 0;
+    float sourceInterval = 1.0f / 60.0f;   // smoothed, seconds between real frames
+
+    // Displayed frames per source frame. FFX only generates one frame, so
+    // 3x/4x (and 2x without an FFX context) use our interpolate kernel on
+    // the previous and current output.
+    int  multiplier = 2;
+    bool adaptive = false;
+    bool extrapolate = false;    // predict past the newest frame instead of holding it back
+    bool ownKernels = true;      // device can run interpolate/extrapolate.comp; else FFX 2x only
+    int  activeMultiplier = 2;   // == multiplier unless adaptive
+    int  pairFrames = 1;         // frames in the pair being presented
+    float refreshHz = 60.0f;
+    bool outputHistoryValid = false;   // outputColorImage holds the last real frame
+
+    // GPU cost for the adaptive budget: GpuProfiler::frameMs / generatedMs
+    uint32_t framesSinceAdapt = 0;
+};
+
 struct FSRContext {
     ffx::CreateBackendVKDesc backendDesc{};
     ffx::CreateContextDescUpscale createFsr{};
@@ -312,16 +1188,21 @@ struct FSRContext {
 
     ffx::DispatchDescUpscale dispatchUpscale{};
     ffx::ReturnCode retCodeDispatch;
+
+    // Drop temporal history on the next dispatch (first frame, resize, ...)
+    bool resetHistory = true;
+
+    FSRContextCache cache;
+    FSRAsyncInit pending;
+
+    FrameGenState frameGen;
 };
 
 uint32_t findMemoryType(
-    VkPhysicalDevice phys,
+    const VkPhysicalDeviceMemoryProperties& memProps,
     uint32_t typeFilter,
     VkMemoryPropertyFlags properties)
 {
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(phys, &memProps);
-
     for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i) {
         if ((typeFilter & (1u << i)) &&
             (memProps.memoryTypes[i].propertyFlags & properties) == properties) {
@@ -333,26 +1214,324 @@ uint32_t findMemoryType(
     return 0;
 }
 
-void create_instance(VulkanContext& vc)
-{
-    const char* extensions[] = {
-        VK_KHR_SURFACE_EXTENSION_NAME,
-        VK_KHR_XLIB_SURFACE_EXTENSION_NAME
-    };
+/* -------------------------- GPU memory -------------------------- */
 
-    VkApplicationInfo app{};
-    app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    app.pApplicationName = "X11 Capture Vulkan";
-    app.applicationVersion = VK_MAKE_VERSION(1,0,0);
-    app.pEngineName = "NoEngine";
-    app.engineVersion = VK_MAKE_VERSION(1,0,0);
-    app.apiVersion = VK_API_VERSION_1_1;
+// Blocks are only released beyond kSpareLimit of empty ones, so a resize or
+// a new session of the same size reuses memory instead of going back to the
+// driver. Large requests get a block of their own (a buddy range would waste
+// up to half of it); dedicated requirements from the driver are honoured.
 
-    VkInstanceCreateInfo ci{};
-    ci.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    ci.pApplicationInfo = &app;
-    ci.enabledExtensionCount = 2;
-    ci.ppEnabledExtensionNames = extensions;
+void gpu_allocator_init(VulkanContext& vc)
+{
+    vkGetPhysicalDeviceMemoryProperties(vc.physDevice, &vc.allocator.memProps);
+}
+
+static uint32_t buddy_order(VkDeviceSize size)
+{
+    uint32_t order = 0;
+    while ((GpuAllocator::kMinRange << order) < size) ++order;
+    return order;
+}
+
+static bool buddy_take(GpuBlock& b, uint32_t order, VkDeviceSize& offset)
+{
+    uint32_t k = order;
+    while (k < b.freeRanges.size() && b.freeRanges[k].empty()) ++k;
+    if (k >= b.freeRanges.size()) return false;
+
+    offset = b.freeRanges[k].back();
+    b.freeRanges[k].pop_back();
+    while (k > order) {   // split, keep the lower half
+        --k;
+        b.freeRanges[k].push_back(offset + (GpuAllocator::kMinRange << k));
+    }
+    return true;
+}
+
+static void buddy_give(GpuBlock& b, uint32_t order, VkDeviceSize offset)
+{
+    // Merge with the free buddy as far up as it goes
+    while (order + 1 < b.freeRanges.size()) {
+        VkDeviceSize buddy = offset ^ (GpuAllocator::kMinRange << order);
+        auto& list = b.freeRanges[order];
+        auto it = std::find(list.begin(), list.end(), buddy);
+        if (it == list.end()) break;
+        list.erase(it);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    b.freeRanges[order].push_back(offset);
+}
+
+static bool gpu_block_take(GpuBlock& b, const VkMemoryRequirements& req,
+                           VkDeviceSize& offset, VkDeviceSize& size)
+{
+    switch (b.strategy) {
+    case AllocStrategy::Linear: {
+        VkDeviceSize at = (b.head + req.alignment - 1) / req.alignment * req.alignment;
+        if (at + req.size > b.size) return false;
+        offset = at;
+        size = req.size;
+        b.head = at + req.size;
+        return true;
+    }
+    case AllocStrategy::Pool:
+        if (b.freeSlots.empty()) return false;
+        offset = b.freeSlots.back();
+        b.freeSlots.pop_back();
+        size = GpuAllocator::kPoolSlot;
+        return true;
+    case AllocStrategy::Whole:
+        // A spare one, not much bigger than needed
+        if (b.live || b.size < req.size || b.size > req.size + req.size / 4) return false;
+        offset = 0;
+        size = b.size;
+        return true;
+    case AllocStrategy::Buddy: {
+        uint32_t order = buddy_order(std::max(req.size, req.alignment));
+        if (!buddy_take(b, order, offset)) return false;
+        size = GpuAllocator::kMinRange << order;
+        return true;
+    }
+    case AllocStrategy::Dedicated:
+        break;
+    }
+    return false;
+}
+
+static int32_t gpu_new_block(VulkanContext& vc, AllocStrategy strategy, uint32_t typeIndex,
+                             bool forImages, VkDeviceSize size, const void* pNext)
+{
+    GpuAllocator& ga = vc.allocator;
+
+    VkMemoryAllocateInfo mai{};
+    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mai.pNext = pNext;
+    mai.allocationSize = size;
+    mai.memoryTypeIndex = typeIndex;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    vk_check(vkAllocateMemory(vc.device, &mai, nullptr, &memory), "vkAllocateMemory");
+    ga.reserved += size;
+    ga.peakReserved = std::max(ga.peakReserved, ga.reserved);
+    ga.heapReserved[ga.memProps.memoryTypes[typeIndex].heapIndex] += size;
+    ++ga.deviceAllocations;
+
+    int32_t index = -1;
+    for (size_t i = 0; i < ga.blocks.size(); ++i) {
+        if (!ga.blocks[i].memory) { index = (int32_t)i; break; }
+    }
+    if (index < 0) {
+        ga.blocks.emplace_back();
+        index = (int32_t)ga.blocks.size() - 1;
+    }
+
+    GpuBlock& b = ga.blocks[index];
+    b = GpuBlock{};
+    b.memory = memory;
+    b.size = size;
+    b.typeIndex = typeIndex;
+    b.strategy = strategy;
+    b.forImages = forImages;
+    if (strategy == AllocStrategy::Pool) {
+        // Popped from the back: lowest offsets first
+        for (VkDeviceSize o = size; o >= GpuAllocator::kPoolSlot; o -= GpuAllocator::kPoolSlot) {
+            b.freeSlots.push_back(o - GpuAllocator::kPoolSlot);
+        }
+    } else if (strategy == AllocStrategy::Buddy) {
+        b.freeRanges.resize(buddy_order(size) + 1);
+        b.freeRanges.back().push_back(0);
+    }
+    return index;
+}
+
+static void gpu_release_block(VulkanContext& vc, GpuBlock& b)
+{
+    if (b.mapped) vkUnmapMemory(vc.device, b.memory);
+    vkFreeMemory(vc.device, b.memory, nullptr);
+    GpuAllocator& ga = vc.allocator;
+    ga.reserved -= b.size;
+    ga.heapReserved[ga.memProps.memoryTypes[b.typeIndex].heapIndex] -= b.size;
+    b = GpuBlock{};
+}
+
+static GpuAllocation gpu_alloc(
+    VulkanContext& vc,
+    const VkMemoryRequirements& req,
+    VkMemoryPropertyFlags props,
+    AllocStrategy strategy,
+    bool forImages,
+    const VkMemoryDedicatedAllocateInfo* dedicated)
+{
+    GpuAllocator& ga = vc.allocator;
+    const uint32_t typeIndex = findMemoryType(ga.memProps, req.memoryTypeBits, props);
+
+    if (dedicated) {
+        strategy = AllocStrategy::Dedicated;
+    } else if (req.size <= GpuAllocator::kPoolSlot && req.alignment <= GpuAllocator::kPoolSlot) {
+        strategy = AllocStrategy::Pool;
+    } else if (req.size > GpuAllocator::kWholeAbove) {
+        strategy = AllocStrategy::Whole;
+    }
+
+    GpuAllocation a;
+    int32_t index = -1;
+    if (strategy != AllocStrategy::Dedicated) {
+        for (size_t i = 0; i < ga.blocks.size() && index < 0; ++i) {
+            GpuBlock& b = ga.blocks[i];
+            if (!b.memory || b.typeIndex != typeIndex || b.strategy != strategy ||
+                b.forImages != forImages) continue;
+            if (gpu_block_take(b, req, a.offset, a.size)) index = (int32_t)i;
+        }
+    }
+
+    if (index < 0) {
+        VkDeviceSize blockSize = GpuAllocator::kBlockSize;
+        if (strategy == AllocStrategy::Pool) blockSize = GpuAllocator::kPoolBlock;
+        if (strategy == AllocStrategy::Whole || strategy == AllocStrategy::Dedicated) blockSize = req.size;
+
+        index = gpu_new_block(vc, strategy, typeIndex, forImages, blockSize, dedicated);
+        if (strategy == AllocStrategy::Dedicated) {
+            a.offset = 0;
+            a.size = req.size;
+        } else if (!gpu_block_take(ga.blocks[index], req, a.offset, a.size)) {
+            fatal("gpu_alloc: request doesn't fit a fresh block");
+        }
+    }
+
+    GpuBlock& b = ga.blocks[index];
+    ++b.live;
+    ga.used += a.size;
+    a.memory = b.memory;
+    a.block = index;
+    return a;
+}
+
+// Allocates and binds. Driver-preferred dedicated allocations are only
+// taken for large images, where a block of their own costs nothing extra.
+GpuAllocation gpu_alloc_image(VulkanContext& vc, VkImage image, VkMemoryPropertyFlags props,
+                              AllocStrategy strategy = AllocStrategy::Buddy)
+{
+    VkMemoryDedicatedRequirements dr{};
+    dr.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 r2{};
+    r2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    r2.pNext = &dr;
+    VkImageMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    info.image = image;
+    vkGetImageMemoryRequirements2(vc.device, &info, &r2);
+
+    VkMemoryDedicatedAllocateInfo dai{};
+    dai.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dai.image = image;
+    const bool dedicated = dr.requiresDedicatedAllocation ||
+        (dr.prefersDedicatedAllocation && r2.memoryRequirements.size > GpuAllocator::kWholeAbove);
+
+    GpuAllocation a = gpu_alloc(vc, r2.memoryRequirements, props, strategy, true,
+                                dedicated ? &dai : nullptr);
+    vk_check(vkBindImageMemory(vc.device, image, a.memory, a.offset), "vkBindImageMemory");
+    return a;
+}
+
+GpuAllocation gpu_alloc_buffer(VulkanContext& vc, VkBuffer buffer, VkMemoryPropertyFlags props,
+                               AllocStrategy strategy = AllocStrategy::Buddy)
+{
+    VkMemoryDedicatedRequirements dr{};
+    dr.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 r2{};
+    r2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    r2.pNext = &dr;
+    VkBufferMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    info.buffer = buffer;
+    vkGetBufferMemoryRequirements2(vc.device, &info, &r2);
+
+    VkMemoryDedicatedAllocateInfo dai{};
+    dai.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dai.buffer = buffer;
+    const bool dedicated = dr.requiresDedicatedAllocation ||
+        (dr.prefersDedicatedAllocation && r2.memoryRequirements.size > GpuAllocator::kWholeAbove);
+
+    GpuAllocation a = gpu_alloc(vc, r2.memoryRequirements, props, strategy, false,
+                                dedicated ? &dai : nullptr);
+    vk_check(vkBindBufferMemory(vc.device, buffer, a.memory, a.offset), "vkBindBufferMemory");
+    return a;
+}
+
+// Host-visible allocations; the block stays mapped until it is released
+void* gpu_map(VulkanContext& vc, const GpuAllocation& a)
+{
+    GpuBlock& b = vc.allocator.blocks[a.block];
+    if (!b.mapped) {
+        vk_check(vkMapMemory(vc.device, b.memory, 0, VK_WHOLE_SIZE, 0, &b.mapped), "vkMapMemory");
+    }
+    return static_cast<uint8_t*>(b.mapped) + a.offset;
+}
+
+// The resource using `a` must be destroyed (or about to be) by the caller
+void gpu_free(VulkanContext& vc, GpuAllocation& a)
+{
+    if (!a.memory) return;
+    GpuAllocator& ga = vc.allocator;
+    GpuBlock& b = ga.blocks[a.block];
+
+    switch (b.strategy) {
+    case AllocStrategy::Pool:  b.freeSlots.push_back(a.offset); break;
+    case AllocStrategy::Buddy: buddy_give(b, buddy_order(a.size), a.offset); break;
+    default: break;
+    }
+    ga.used -= a.size;
+    a = GpuAllocation{};
+
+    if (--b.live > 0) return;
+    b.head = 0;
+
+    // Empty: keep it for reuse unless too much is parked already
+    VkDeviceSize spare = 0;
+    for (const GpuBlock& o : ga.blocks) {
+        if (o.memory && !o.live && &o != &b) spare += o.size;
+    }
+    if (b.strategy == AllocStrategy::Dedicated || spare + b.size > GpuAllocator::kSpareLimit) {
+        gpu_release_block(vc, b);
+    }
+}
+
+void gpu_allocator_destroy(VulkanContext& vc)
+{
+    GpuAllocator& ga = vc.allocator;
+    uint32_t leaked = 0;
+    for (GpuBlock& b : ga.blocks) {
+        if (!b.memory) continue;
+        leaked += b.live;
+        gpu_release_block(vc, b);
+    }
+    ga.blocks.clear();
+
+    std::printf("GPU memory: %u driver allocations, peak %.1f MiB reserved\n",
+                ga.deviceAllocations, ga.peakReserved / (1024.0 * 1024.0));
+    if (leaked) std::fprintf(stderr, "GPU memory: %u allocations still live at shutdown\n", leaked);
+}
+
+void create_instance(VulkanContext& vc)
+{
+    const char* extensions[] = {
+        VK_KHR_SURFACE_EXTENSION_NAME,
+        VK_KHR_XLIB_SURFACE_EXTENSION_NAME
+    };
+
+    VkApplicationInfo app{};
+    app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app.pApplicationName = "X11 Capture Vulkan";
+    app.applicationVersion = VK_MAKE_VERSION(1,0,0);
+    app.pEngineName = "NoEngine";
+    app.engineVersion = VK_MAKE_VERSION(1,0,0);
+    app.apiVersion = VK_API_VERSION_1_1;
+
+    VkInstanceCreateInfo ci{};
+    ci.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    ci.pApplicationInfo = &app;
+    ci.enabledExtensionCount = 2;
+    ci.ppEnabledExtensionNames = extensions;
 
     vk_check(vkCreateInstance(&ci, nullptr, &vc.instance), "vkCreateInstance");
 }
@@ -409,24 +1588,643 @@ void create_device_and_queue(VulkanContext& vc)
     qci.queueCount = 1;
     qci.pQueuePriorities = &priority;
 
-    const char* extensions[] = {
+    std::vector<const char*> extensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
         VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME,
         VK_KHR_BIND_MEMORY_2_EXTENSION_NAME
     };
 
+    // Optional: UNORM storage views of an sRGB swapchain
+    uint32_t extCount = 0;
+    vkEnumerateDeviceExtensionProperties(vc.physDevice, nullptr, &extCount, nullptr);
+    std::vector<VkExtensionProperties> available(extCount);
+    vkEnumerateDeviceExtensionProperties(vc.physDevice, nullptr, &extCount, available.data());
+    bool haveMutable = false, haveFormatList = false;
+    bool havePresentId = false, havePresentWait = false, haveDisplayTiming = false;
+    for (const auto& e : available) {
+        if (std::strcmp(e.extensionName, VK_KHR_SWAPCHAIN_MUTABLE_FORMAT_EXTENSION_NAME) == 0) haveMutable = true;
+        if (std::strcmp(e.extensionName, VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME) == 0) haveFormatList = true;
+        if (std::strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) vc.budget.supported = true;
+        if (std::strcmp(e.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0) havePresentId = true;
+        if (std::strcmp(e.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0) havePresentWait = true;
+        if (std::strcmp(e.extensionName, VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME) == 0) haveDisplayTiming = true;
+    }
+    vc.swapMutableFormat = haveMutable && haveFormatList;
+    if (vc.swapMutableFormat) {
+        extensions.push_back(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_SWAPCHAIN_MUTABLE_FORMAT_EXTENSION_NAME);
+    }
+    // Optional: real VRAM budget and process usage
+    if (vc.budget.supported) {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
+    // Optional: when presents reach the display, for capture-to-photon
+    // latency. Display timing has the actual time, present_wait only says
+    // it happened; present_wait needs its features on top of the extensions.
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    presentIdFeatures.pNext = &presentWaitFeatures;
+    if (haveDisplayTiming) {
+        extensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+        vc.photon.method = PhotonLatency::Method::DisplayTiming;
+    } else if (havePresentId && havePresentWait) {
+        VkPhysicalDeviceFeatures2 query{};
+        query.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        query.pNext = &presentIdFeatures;
+        vkGetPhysicalDeviceFeatures2(vc.physDevice, &query);
+        if (presentIdFeatures.presentId && presentWaitFeatures.presentWait) {
+            extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            vc.photon.method = PhotonLatency::Method::PresentWait;
+        }
+    }
+
+    // rg16f storage for the motion vectors is an "extended" storage format
+    VkPhysicalDeviceFeatures supported{};
+    vkGetPhysicalDeviceFeatures(vc.physDevice, &supported);
+    VkPhysicalDeviceFeatures features{};
+    features.shaderStorageImageExtendedFormats = supported.shaderStorageImageExtendedFormats;
+    if (!supported.shaderStorageImageExtendedFormats) {
+        std::fprintf(stderr, "Device lacks shaderStorageImageExtendedFormats, motion vectors may fail\n");
+    }
+    // BGRA8 has no shader format qualifier, kernels writing it declare none
+    features.shaderStorageImageWriteWithoutFormat = supported.shaderStorageImageWriteWithoutFormat;
+    vc.storageWriteWithoutFormat = supported.shaderStorageImageWriteWithoutFormat;
+    if (!supported.shaderStorageImageWriteWithoutFormat) {
+        std::fprintf(stderr, "Device lacks shaderStorageImageWriteWithoutFormat, frame generation limited to FFX, "
+                             "no spatial scaler, foveation or HUD\n");
+    }
+
     VkDeviceCreateInfo ci{};
     ci.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     ci.queueCreateInfoCount = 1;
     ci.pQueueCreateInfos = &qci;
-    ci.enabledExtensionCount = 4;
-    ci.ppEnabledExtensionNames = extensions;
+    ci.enabledExtensionCount = (uint32_t)extensions.size();
+    ci.ppEnabledExtensionNames = extensions.data();
+    ci.pEnabledFeatures = &features;
+    if (vc.photon.method == PhotonLatency::Method::PresentWait) {
+        ci.pNext = &presentIdFeatures;   // query left both on
+    }
 
     vk_check(vkCreateDevice(vc.physDevice, &ci, nullptr, &vc.device), "vkCreateDevice");
     vkGetDeviceQueue(vc.device, vc.queueFamilyIndex, 0, &vc.queue);
+
+    if (vc.photon.method == PhotonLatency::Method::DisplayTiming) {
+        vc.photon.pastTiming = (PFN_vkGetPastPresentationTimingGOOGLE)
+            vkGetDeviceProcAddr(vc.device, "vkGetPastPresentationTimingGOOGLE");
+    } else if (vc.photon.method == PhotonLatency::Method::PresentWait) {
+        vc.photon.waitForPresent = (PFN_vkWaitForPresentKHR)
+            vkGetDeviceProcAddr(vc.device, "vkWaitForPresentKHR");
+    }
+    if (!vc.photon.pastTiming && !vc.photon.waitForPresent) {
+        vc.photon.method = PhotonLatency::Method::Estimate;
+    }
+}
+
+/* ------------------------ Pipeline cache ------------------------ */
+
+// On-disk layout: our header, then the raw vkGetPipelineCacheData blob. The
+// header pins the exact device and driver build; anything else is dropped.
+struct PipelineCacheFileHeader {
+    uint32_t magic = 0x4350534c;   // "LSPC"
+    uint32_t version = 1;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    uint8_t  deviceUUID[VK_UUID_SIZE] = {};
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE] = {};
+    uint64_t dataSize = 0;
+    uint64_t dataHash = 0;
+};
+
+static uint64_t fnv1a64(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// $XDG_CACHE_HOME/lsfl (or ~/.cache/lsfl), created on demand
+static std::string cache_dir()
+{
+    std::string base;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        base = xdg;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return std::string();
+    }
+    mkdir(base.c_str(), 0755);
+    std::string dir = base + "/lsfl";
+    mkdir(dir.c_str(), 0755);
+    return dir;
+}
+
+static PipelineCacheFileHeader pipeline_cache_header(const VulkanContext& vc)
+{
+    VkPhysicalDeviceIDProperties idProps{};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 props{};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &idProps;
+    vkGetPhysicalDeviceProperties2(vc.physDevice, &props);
+
+    PipelineCacheFileHeader h{};
+    h.vendorID      = props.properties.vendorID;
+    h.deviceID      = props.properties.deviceID;
+    h.driverVersion = props.properties.driverVersion;
+    std::memcpy(h.deviceUUID, idProps.deviceUUID, VK_UUID_SIZE);
+    std::memcpy(h.pipelineCacheUUID, props.properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return h;
+}
+
+void create_pipeline_cache(VulkanContext& vc)
+{
+    PipelineCacheFileHeader want = pipeline_cache_header(vc);
+    std::vector<uint8_t> data;
+
+    std::string dir = cache_dir();
+    if (!dir.empty()) {
+        std::string path = dir + "/pipeline_cache.bin";
+        if (std::FILE* f = std::fopen(path.c_str(), "rb")) {
+            PipelineCacheFileHeader h{};
+            bool ok = std::fread(&h, sizeof(h), 1, f) == 1 &&
+                      h.magic == want.magic && h.version == want.version &&
+                      h.vendorID == want.vendorID && h.deviceID == want.deviceID &&
+                      h.driverVersion == want.driverVersion &&
+                      std::memcmp(h.deviceUUID, want.deviceUUID, VK_UUID_SIZE) == 0 &&
+                      std::memcmp(h.pipelineCacheUUID, want.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+                      h.dataSize > 0 && h.dataSize < (256ull << 20);
+            if (ok) {
+                data.resize((size_t)h.dataSize);
+                ok = std::fread(data.data(), 1, data.size(), f) == data.size() &&
+                     fnv1a64(data.data(), data.size()) == h.dataHash;
+            }
+            if (!ok) {
+                std::printf("Pipeline cache: %s is stale or corrupt, ignoring\n", path.c_str());
+                data.clear();
+            }
+            std::fclose(f);
+        }
+    }
+
+    VkPipelineCacheCreateInfo ci{};
+    ci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    ci.initialDataSize = data.size();
+    ci.pInitialData = data.empty() ? nullptr : data.data();
+
+    VkResult r = vkCreatePipelineCache(vc.device, &ci, nullptr, &vc.pipelineCache);
+    if (r != VK_SUCCESS && !data.empty()) {
+        // Driver rejected the blob anyway, start empty
+        ci.initialDataSize = 0;
+        ci.pInitialData = nullptr;
+        data.clear();
+        r = vkCreatePipelineCache(vc.device, &ci, nullptr, &vc.pipelineCache);
+    }
+    vk_check(r, "vkCreatePipelineCache");
+
+    vc.pipelineCacheWarm = !data.empty();
+    std::printf("Pipeline cache: %s (%zu KB)\n",
+                vc.pipelineCacheWarm ? "warm" : "cold", data.size() / 1024);
+}
+
+// Written to a temp file and renamed so a crash never leaves half a cache
+void save_pipeline_cache(const VulkanContext& vc)
+{
+    if (!vc.pipelineCache) return;
+
+    std::string dir = cache_dir();
+    if (dir.empty()) return;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(vc.device, vc.pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+        return;
+    }
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(vc.device, vc.pipelineCache, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+    data.resize(size);
+
+    PipelineCacheFileHeader h = pipeline_cache_header(vc);
+    h.dataSize = data.size();
+    h.dataHash = fnv1a64(data.data(), data.size());
+
+    std::string path = dir + "/pipeline_cache.bin";
+    std::string tmp  = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) return;
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+              std::fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (ok) {
+        std::rename(tmp.c_str(), path.c_str());
+    } else {
+        std::remove(tmp.c_str());
+    }
+}
+
+// The FFX Vulkan backend has no pipeline cache parameter, but it resolves all
+// entry points through the vkDeviceProcAddr we give it. Hand it a wrapper
+// that routes cache-less pipeline creation through our cache.
+static VkPipelineCache g_ffxPipelineCache = VK_NULL_HANDLE;
+static PFN_vkCreateComputePipelines g_realCreateComputePipelines = nullptr;
+
+static VKAPI_ATTR VkResult VKAPI_CALL ffx_create_compute_pipelines(
+    VkDevice device,
+    VkPipelineCache cache,
+    uint32_t count,
+    const VkComputePipelineCreateInfo* infos,
+    const VkAllocationCallbacks* alloc,
+    VkPipeline* pipelines)
+{
+    if (cache == VK_NULL_HANDLE) cache = g_ffxPipelineCache;
+    return g_realCreateComputePipelines(device, cache, count, infos, alloc, pipelines);
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL ffx_get_device_proc_addr(VkDevice device, const char* name)
+{
+    if (g_realCreateComputePipelines && std::strcmp(name, "vkCreateComputePipelines") == 0) {
+        return reinterpret_cast<PFN_vkVoidFunction>(&ffx_create_compute_pipelines);
+    }
+    return vkGetDeviceProcAddr(device, name);
+}
+
+void install_ffx_pipeline_cache(VulkanContext& vc)
+{
+    g_ffxPipelineCache = vc.pipelineCache;
+    g_realCreateComputePipelines = reinterpret_cast<PFN_vkCreateComputePipelines>(
+        vkGetDeviceProcAddr(vc.device, "vkCreateComputePipelines"));
+}
+
+void destroy_pipeline_cache(VulkanContext& vc)
+{
+    if (vc.pipelineCache) {
+        save_pipeline_cache(vc);
+        vkDestroyPipelineCache(vc.device, vc.pipelineCache, nullptr);
+        vc.pipelineCache = VK_NULL_HANDLE;
+    }
+    g_ffxPipelineCache = VK_NULL_HANDLE;
+}
+
+/* ------------------------ Compute passes ------------------------ */
+
+static const uint32_t kExtrapolateSpv[] =
+#include "extrapolate.spv.h"
+;
+
+static const uint32_t kFoveateCompositeSpv[] =
+#include "foveate_composite.spv.h"
+;
+
+static const uint32_t kHudOverlaySpv[] =
+#include "hud_overlay.spv.h"
+;
+
+static const uint32_t kInterpolateSpv[] =
+#include "interpolate.spv.h"
+;
+
+static const uint32_t kLumaDownsampleSpv[] =
+#include "luma_downsample.spv.h"
+;
+
+static const uint32_t kMotionEstimateSpv[] =
+#include "motion_estimate.spv.h"
+;
+
+static const uint32_t kSpatialFusedSpv[] =
+#include "spatial_fused.spv.h"
+;
+
+static const uint32_t kSpatialUpscaleSpv[] =
+#include "spatial_upscale.spv.h"
+;
+
+static const uint32_t kTileDiffSpv[] =
+#include "tile_diff.spv.h"
+;
+
+// Tunables, e.g. LSFL_ME_BLOCK=16 LSFL_ME_RADIUS=6 LSFL_ME_LEVELS=5
+static MotionEstimatorParams motion_params_from_env()
+{
+    MotionEstimatorParams p{};
+    if (const char* v = std::getenv("LSFL_ME_BLOCK")) {
+        int b = std::atoi(v);
+        p.blockSize = (b >= 16) ? 16 : (b >= 8) ? 8 : 4;
+    }
+    if (const char* v = std::getenv("LSFL_ME_RADIUS")) {
+        p.searchRadius = std::clamp(std::atoi(v), 1, 16);
+    }
+    if (const char* v = std::getenv("LSFL_ME_LEVELS")) {
+        p.levels = std::clamp(std::atoi(v), 1, 6);
+    }
+    return p;
+}
+
+void create_compute_pass(
+    VulkanContext& vc,
+    ComputePass& pass,
+    const uint32_t* code, size_t codeSize,
+    std::initializer_list<VkDescriptorType> bindings,
+    uint32_t pushConstantSize,
+    uint32_t setCount = 1,
+    const VkSpecializationInfo* spec = nullptr)
+{
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (VkDescriptorType type : bindings) {
+        VkDescriptorSetLayoutBinding b{};
+        b.binding = (uint32_t)layoutBindings.size();
+        b.descriptorType = type;
+        b.descriptorCount = 1;
+        b.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        layoutBindings.push_back(b);
+        poolSizes.push_back({ type, setCount });
+    }
+
+    VkDescriptorSetLayoutCreateInfo dslci{};
+    dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    dslci.bindingCount = (uint32_t)layoutBindings.size();
+    dslci.pBindings = layoutBindings.data();
+    vk_check(vkCreateDescriptorSetLayout(vc.device, &dslci, nullptr, &pass.setLayout),
+             "vkCreateDescriptorSetLayout");
+
+    VkPushConstantRange pcr{};
+    pcr.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pcr.offset = 0;
+    pcr.size = pushConstantSize;
+
+    VkPipelineLayoutCreateInfo plci{};
+    plci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    plci.setLayoutCount = 1;
+    plci.pSetLayouts = &pass.setLayout;
+    plci.pushConstantRangeCount = pushConstantSize ? 1 : 0;
+    plci.pPushConstantRanges = pushConstantSize ? &pcr : nullptr;
+    vk_check(vkCreatePipelineLayout(vc.device, &plci, nullptr, &pass.layout),
+             "vkCreatePipelineLayout");
+
+    VkShaderModuleCreateInfo smci{};
+    smci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    smci.codeSize = codeSize;
+    smci.pCode = code;
+    VkShaderModule module = VK_NULL_HANDLE;
+    vk_check(vkCreateShaderModule(vc.device, &smci, nullptr, &module), "vkCreateShaderModule");
+
+    VkComputePipelineCreateInfo cpci{};
+    cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    cpci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    cpci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    cpci.stage.module = module;
+    cpci.stage.pName = "main";
+    cpci.stage.pSpecializationInfo = spec;
+    cpci.layout = pass.layout;
+    vk_check(vkCreateComputePipelines(vc.device, vc.pipelineCache, 1, &cpci, nullptr, &pass.pipeline),
+             "vkCreateComputePipelines");
+    vkDestroyShaderModule(vc.device, module, nullptr);
+
+    VkDescriptorPoolCreateInfo dpci{};
+    dpci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    dpci.maxSets = setCount;
+    dpci.poolSizeCount = (uint32_t)poolSizes.size();
+    dpci.pPoolSizes = poolSizes.data();
+    vk_check(vkCreateDescriptorPool(vc.device, &dpci, nullptr, &pass.pool), "vkCreateDescriptorPool");
+
+    std::vector<VkDescriptorSetLayout> layouts(setCount, pass.setLayout);
+    pass.sets.resize(setCount);
+    VkDescriptorSetAllocateInfo dsai{};
+    dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    dsai.descriptorPool = pass.pool;
+    dsai.descriptorSetCount = setCount;
+    dsai.pSetLayouts = layouts.data();
+    vk_check(vkAllocateDescriptorSets(vc.device, &dsai, pass.sets.data()), "vkAllocateDescriptorSets");
+}
+
+void destroy_compute_pass(VulkanContext& vc, ComputePass& pass)
+{
+    if (pass.pool) vkDestroyDescriptorPool(vc.device, pass.pool, nullptr);
+    if (pass.pipeline) vkDestroyPipeline(vc.device, pass.pipeline, nullptr);
+    if (pass.layout) vkDestroyPipelineLayout(vc.device, pass.layout, nullptr);
+    if (pass.setLayout) vkDestroyDescriptorSetLayout(vc.device, pass.setLayout, nullptr);
+    pass = ComputePass{};
+}
+
+// Sampled images default to vc.pointSampler (texelFetch); pass
+// vc.linearSampler for kernels that filter
+void write_image_descriptor(
+    VulkanContext& vc,
+    VkDescriptorSet set,
+    uint32_t binding,
+    VkDescriptorType type,
+    VkImageView view,
+    VkImageLayout layout,
+    VkSampler sampler = VK_NULL_HANDLE)
+{
+    if (type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER && !sampler) sampler = vc.pointSampler;
+
+    VkDescriptorImageInfo info{};
+    info.sampler = sampler;
+    info.imageView = view;
+    info.imageLayout = layout;
+
+    VkWriteDescriptorSet w{};
+    w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    w.dstSet = set;
+    w.dstBinding = binding;
+    w.descriptorCount = 1;
+    w.descriptorType = type;
+    w.pImageInfo = &info;
+    vkUpdateDescriptorSets(vc.device, 1, &w, 0, nullptr);
+}
+
+void write_buffer_descriptor(VulkanContext& vc, VkDescriptorSet set, uint32_t binding, VkBuffer buffer)
+{
+    VkDescriptorBufferInfo info{};
+    info.buffer = buffer;
+    info.offset = 0;
+    info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet w{};
+    w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    w.dstSet = set;
+    w.dstBinding = binding;
+    w.descriptorCount = 1;
+    w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    w.pBufferInfo = &info;
+    vkUpdateDescriptorSets(vc.device, 1, &w, 0, nullptr);
+}
+
+// Also used when a session falls back to the spatial scaler (VRAM budget)
+void create_spatial_passes(VulkanContext& vc)
+{
+    // curr input, history, tile list
+    create_compute_pass(
+        vc, vc.spatial.diffPass,
+        kTileDiffSpv, sizeof(kTileDiffSpv),
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+        sizeof(int32_t) * 3
+    );
+
+    // input, tile list -> output
+    create_compute_pass(
+        vc, vc.spatial.upscalePass,
+        kSpatialUpscaleSpv, sizeof(kSpatialUpscaleSpv),
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        sizeof(int32_t) * 4
+    );
+    std::printf("Scaler: spatial, incremental over %ux%u tiles\n",
+                SpatialScaler::kTile, SpatialScaler::kTile);
+
+    if (vc.spatial.fused) {
+        // staging buffer -> swapchain image
+        create_compute_pass(
+            vc, vc.spatial.fusedPass,
+            kSpatialFusedSpv, sizeof(kSpatialFusedSpv),
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+              VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+            sizeof(int32_t) * 9 + sizeof(float)
+        );
+    }
+}
+
+void create_compute_passes(VulkanContext& vc)
+{
+    VkSamplerCreateInfo sci{};
+    sci.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sci.magFilter = VK_FILTER_NEAREST;
+    sci.minFilter = VK_FILTER_NEAREST;
+    sci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sci.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sci.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    vk_check(vkCreateSampler(vc.device, &sci, nullptr, &vc.pointSampler), "vkCreateSampler");
+
+    sci.magFilter = VK_FILTER_LINEAR;
+    sci.minFilter = VK_FILTER_LINEAR;
+    vk_check(vkCreateSampler(vc.device, &sci, nullptr, &vc.linearSampler), "vkCreateSampler");
+
+    // Own frame generation kernels (FrameGenState::ownKernels)
+    if (vc.storageWriteWithoutFormat) {
+        // prev output, curr output, motion vectors -> generated frame
+        create_compute_pass(
+            vc, vc.interpolatePass,
+            kInterpolateSpv, sizeof(kInterpolateSpv),
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+            sizeof(int32_t) * 2 + sizeof(float)
+        );
+
+        // curr output, motion vectors -> predicted frame
+        create_compute_pass(
+            vc, vc.extrapolatePass,
+            kExtrapolateSpv, sizeof(kExtrapolateSpv),
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+            sizeof(int32_t) * 2 + sizeof(float)
+        );
+    }
+
+    MotionEstimator& me = vc.motion;
+    me.params = motion_params_from_env();
+    uint32_t sets = 2 * (uint32_t)me.params.levels;
+
+    // src (color or finer luma) -> luma level
+    create_compute_pass(
+        vc, me.downsamplePass,
+        kLumaDownsampleSpv, sizeof(kLumaDownsampleSpv),
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        sizeof(int32_t) * 5,
+        sets
+    );
+
+    // Block size and radius size the shared-memory tiles: specialization
+    // constants 0 (BLOCK), 1 (MAX_RADIUS), 2/3 (local_size_x/y = BLOCK)
+    const int32_t specData[4] = {
+        me.params.blockSize, me.params.searchRadius, me.params.blockSize, me.params.blockSize
+    };
+    const VkSpecializationMapEntry specEntries[4] = {
+        { 0, 0, sizeof(int32_t) },
+        { 1, sizeof(int32_t), sizeof(int32_t) },
+        { 2, 2 * sizeof(int32_t), sizeof(int32_t) },
+        { 3, 3 * sizeof(int32_t), sizeof(int32_t) },
+    };
+    VkSpecializationInfo spec{};
+    spec.mapEntryCount = 4;
+    spec.pMapEntries = specEntries;
+    spec.dataSize = sizeof(specData);
+    spec.pData = specData;
+
+    // curr luma, prev luma, coarser vectors -> vectors
+    create_compute_pass(
+        vc, me.searchPass,
+        kMotionEstimateSpv, sizeof(kMotionEstimateSpv),
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+        sizeof(int32_t) * 7,
+        sets,
+        &spec
+    );
+
+    std::printf("Motion estimator: %d levels, %dx%d blocks, radius %d\n",
+                me.params.levels, me.params.blockSize, me.params.blockSize, me.params.searchRadius);
+
+    if (vc.spatial.enabled) create_spatial_passes(vc);
+
+    if (vc.foveation.mode != Foveation::Mode::Off) {
+        // render input, ROI output -> output
+        create_compute_pass(
+            vc, vc.foveation.compositePass,
+            kFoveateCompositeSpv, sizeof(kFoveateCompositeSpv),
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+              VK_DESCRIPTOR_TYPE_STORAGE_IMAGE },
+            sizeof(int32_t) * 7 + sizeof(float) * 2
+        );
+        std::printf("Foveation: %s, %.0f%% per axis, %d px feather\n",
+                    vc.foveation.mode == Foveation::Mode::Pointer ? "pointer" : "center",
+                    vc.foveation.size * 100.0f, vc.foveation.feather);
+    }
 }
 
+void destroy_compute_passes(VulkanContext& vc)
+{
+    destroy_compute_pass(vc, vc.motion.downsamplePass);
+    destroy_compute_pass(vc, vc.motion.searchPass);
+    destroy_compute_pass(vc, vc.interpolatePass);
+    destroy_compute_pass(vc, vc.extrapolatePass);
+    destroy_compute_pass(vc, vc.spatial.diffPass);
+    destroy_compute_pass(vc, vc.spatial.upscalePass);
+    destroy_compute_pass(vc, vc.spatial.fusedPass);
+    destroy_compute_pass(vc, vc.foveation.compositePass);
+    if (vc.pointSampler) vkDestroySampler(vc.device, vc.pointSampler, nullptr);
+    if (vc.linearSampler) vkDestroySampler(vc.device, vc.linearSampler, nullptr);
+    vc.pointSampler = VK_NULL_HANDLE;
+    vc.linearSampler = VK_NULL_HANDLE;
+}
+
+VkImageView create_image_view(VulkanContext& vc, VkImage image, VkFormat format,
+                              VkImageAspectFlags aspectFlags);
+
 void create_swapchain(VulkanContext& vc, int width, int height)
 {
     // Surface capabilities
@@ -508,24 +2306,75 @@ void create_swapchain(VulkanContext& vc, int width, int height)
         imageCount = caps.maxImageCount;
     }
 
+    // Let compute write the swapchain images directly when the surface
+    // allows it; sRGB formats have no storage support, their UNORM twin does
+    vc.swapStorage = false;
+    vc.swapViewFormat = vc.swapchainFormat;
+    if (vc.swapchainFormat == VK_FORMAT_B8G8R8A8_SRGB) vc.swapViewFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    if (vc.swapchainFormat == VK_FORMAT_R8G8B8A8_SRGB) vc.swapViewFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    const bool mutableFormat = vc.swapViewFormat != vc.swapchainFormat;
+    if ((caps.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) &&
+        (!mutableFormat || vc.swapMutableFormat)) {
+        VkFormatProperties fp{};
+        vkGetPhysicalDeviceFormatProperties(vc.physDevice, vc.swapViewFormat, &fp);
+        vc.swapStorage = (fp.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0;
+    }
+    static bool warnedNoStorage = false;
+    if (!vc.swapStorage && !warnedNoStorage) {
+        std::fprintf(stderr, "Swapchain can't be a storage image, output goes through a copy%s\n",
+                     vc.spatial.fused ? " (fused scaler falls back to spatial)" : "");
+        warnedNoStorage = true;
+    }
+
+    const VkFormat viewFormats[2] = { vc.swapchainFormat, vc.swapViewFormat };
+    VkImageFormatListCreateInfoKHR formatList{};
+    formatList.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO_KHR;
+    formatList.viewFormatCount = 2;
+    formatList.pViewFormats = viewFormats;
+
     VkSwapchainCreateInfoKHR sci{};
     sci.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    if (vc.swapStorage && mutableFormat) {
+        sci.flags = VK_SWAPCHAIN_CREATE_MUTABLE_FORMAT_BIT_KHR;
+        sci.pNext = &formatList;
+    }
     sci.surface = vc.surface;
     sci.minImageCount = imageCount;
     sci.imageFormat = vc.swapchainFormat;
     sci.imageColorSpace = chosenFormat.colorSpace;
     sci.imageExtent = vc.swapExtent;
     sci.imageArrayLayers = 1;
-    sci.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    sci.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | (vc.swapStorage ? VK_IMAGE_USAGE_STORAGE_BIT : 0);
     sci.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     sci.preTransform = caps.currentTransform;
     sci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     sci.presentMode = chosenPresentMode;
     sci.clipped = VK_TRUE;
-    sci.oldSwapchain = VK_NULL_HANDLE;
+    sci.oldSwapchain = vc.swapchain; // lets the presentation engine hand images over
+
+    VkSwapchainKHR newSwapchain = VK_NULL_HANDLE;
+    {
+        auto lock = swapchain_lock(vc.photon);
+        vk_check(vkCreateSwapchainKHR(vc.device, &sci, nullptr, &newSwapchain),
+                 "vkCreateSwapchainKHR");
+        photon_set_swapchain(vc.photon, newSwapchain);
+    }
 
-    vk_check(vkCreateSwapchainKHR(vc.device, &sci, nullptr, &vc.swapchain),
-             "vkCreateSwapchainKHR");
+    if (vc.swapchain) {
+        // Two recreations in quick succession: the older one has to go now.
+        // Its last present may still be queued, which the fence doesn't cover.
+        if (vc.retiredSwapchain) {
+            vk_check(vkQueueWaitIdle(vc.queue), "vkQueueWaitIdle retiredSwapchain");
+            vkDestroySwapchainKHR(vc.device, vc.retiredSwapchain, nullptr);
+            for (VkImageView v : vc.retiredSwapViews) vkDestroyImageView(vc.device, v, nullptr);
+            vc.retiredSwapViews.clear();
+        }
+        vc.retiredSwapchain = vc.swapchain;
+        vc.retiredPresents = 0;
+        vc.retiredSwapViews = std::move(vc.swapViews);
+        vc.swapViews.clear();
+    }
+    vc.swapchain = newSwapchain;
 
     vk_check(
         vkGetSwapchainImagesKHR(vc.device, vc.swapchain, &imageCount, nullptr),
@@ -536,17 +2385,21 @@ void create_swapchain(VulkanContext& vc, int width, int height)
         vkGetSwapchainImagesKHR(vc.device, vc.swapchain, &imageCount, vc.swapImages.data()),
         "vkGetSwapchainImagesKHR"
     );
+
+    if (vc.swapStorage) {
+        for (VkImage img : vc.swapImages) {
+            vc.swapViews.push_back(
+                create_image_view(vc, img, vc.swapViewFormat, VK_IMAGE_ASPECT_COLOR_BIT));
+        }
+    }
 }
 
-void create_command_pool_and_buffers(VulkanContext& vc)
+// Command buffers only depend on the swapchain image count, so a recreated
+// swapchain just tops the list up instead of reallocating it.
+void ensure_command_buffers(VulkanContext& vc)
 {
-    VkCommandPoolCreateInfo pci{};
-    pci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pci.queueFamilyIndex = vc.queueFamilyIndex;
-    pci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-
-    vk_check(vkCreateCommandPool(vc.device, &pci, nullptr, &vc.cmdPool),
-             "vkCreateCommandPool");
+    size_t have = vc.cmdBuffers.size();
+    if (have >= vc.swapImages.size()) return;
 
     vc.cmdBuffers.resize(vc.swapImages.size());
 
@@ -554,12 +2407,25 @@ void create_command_pool_and_buffers(VulkanContext& vc)
     ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     ai.commandPool = vc.cmdPool;
     ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    ai.commandBufferCount = static_cast<uint32_t>(vc.cmdBuffers.size());
+    ai.commandBufferCount = static_cast<uint32_t>(vc.cmdBuffers.size() - have);
 
-    vk_check(vkAllocateCommandBuffers(vc.device, &ai, vc.cmdBuffers.data()),
+    vk_check(vkAllocateCommandBuffers(vc.device, &ai, vc.cmdBuffers.data() + have),
              "vkAllocateCommandBuffers");
 }
 
+void create_command_pool_and_buffers(VulkanContext& vc)
+{
+    VkCommandPoolCreateInfo pci{};
+    pci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pci.queueFamilyIndex = vc.queueFamilyIndex;
+    pci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    vk_check(vkCreateCommandPool(vc.device, &pci, nullptr, &vc.cmdPool),
+             "vkCreateCommandPool");
+
+    ensure_command_buffers(vc);
+}
+
 void create_sync_objects(VulkanContext& vc)
 {
     VkSemaphoreCreateInfo sci{};
@@ -586,55 +2452,58 @@ void create_staging_buffer(VulkanContext& vc)
     bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bci.size = vc.stagingSize;
     bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    if (vc.spatial.fused) bci.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;   // read by spatial_fused.comp
     bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     vk_check(vkCreateBuffer(vc.device, &bci, nullptr, &vc.stagingBuffer),
              "vkCreateBuffer stagingBuffer");
 
-    VkMemoryRequirements memReq{};
-    vkGetBufferMemoryRequirements(vc.device, vc.stagingBuffer, &memReq);
-
-    VkMemoryAllocateInfo mai{};
-    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mai.allocationSize = memReq.size;
-    mai.memoryTypeIndex = findMemoryType(
-        vc.physDevice,
-        memReq.memoryTypeBits,
+    vc.stagingMemory = gpu_alloc_buffer(
+        vc, vc.stagingBuffer,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
     );
-
-    vk_check(vkAllocateMemory(vc.device, &mai, nullptr, &vc.stagingMemory),
-             "vkAllocateMemory stagingMemory");
-    vk_check(vkBindBufferMemory(vc.device, vc.stagingBuffer, vc.stagingMemory, 0),
-             "vkBindBufferMemory stagingBuffer");
 }
 
 /* --------- Capture XComposite pixmap into RAM each frame ---------- */
 
 struct CaptureBuffer {
     XImage* image = nullptr;
+    int originX = 0;    // where image sits in the window
+    int originY = 0;
 };
 
-struct FrameHistory {
-    CaptureBuffer prev;
-    CaptureBuffer curr;
-    bool hasPrev = false;
-};
-
-bool capture_frame(const X11Context& xc, CaptureBuffer& cb)
+// Grabs (x, y, w, h) of the target, clipped to its current size
+bool capture_frame(const X11Context& xc, CaptureBuffer& cb, int x, int y, int w, int h)
 {
     if (cb.image) {
         XDestroyImage(cb.image);
         cb.image = nullptr;
     }
 
-    XSync(xc.dpy, False);
+    {
+        TRACE_ZONE("XSync");
+        XSync(xc.dpy, False);
+    }
 
-    cb.image = XGetImage(
+    x = std::clamp(x, 0, std::max(xc.capW - 1, 0));
+    y = std::clamp(y, 0, std::max(xc.capH - 1, 0));
+    w = std::min(w, xc.capW - x);
+    h = std::min(h, xc.capH - y);
+    if (w <= 0 || h <= 0) {
+        x = 0;
+        y = 0;
+        w = xc.capW;
+        h = xc.capH;
+    }
+    cb.originX = x;
+    cb.originY = y;
+
+    TRACE_ZONE("XGetImage");
+    cb.image = XGetImage(
         xc.dpy,
         xc.targetPixmap,
-        0, 0,
-        xc.capW, xc.capH,
+        x, y,
+        w, h,
         AllPlanes,
         ZPixmap
     );
@@ -655,42 +2524,397 @@ bool capture_frame(const X11Context& xc, CaptureBuffer& cb)
 
 
 
+/* ---------------------- Letterbox detection ---------------------- */
+
+// Videos and games with a fixed aspect ratio draw black bars inside the
+// window. Every kProbeEvery captures the whole window is grabbed and
+// scanned; otherwise only the active rectangle is captured, uploaded and
+// upscaled. Growing the crop waits for several agreeing probes (dark
+// scenes), content showing up in a bar undoes it at the next probe.
+struct LetterboxDetector {
+    static constexpr uint32_t kProbeEvery = 30;   // captures between full grabs
+    static constexpr int kStableProbes = 4;       // agreeing probes before cropping further in
+    static constexpr int kBlack = 16;             // brightest bar pixel (video black is 16)
+    static constexpr int kMinBar = 4;             // thinner bars are borders, not letterbox
+
+    bool enabled = true;
+    VkRect2D candidate{};
+    int agree = 0;
+    uint32_t sinceProbe = kProbeEvery;            // probe on the first capture
+};
+
+static bool rect_equal(const VkRect2D& a, const VkRect2D& b)
+{
+    return a.offset.x == b.offset.x && a.offset.y == b.offset.y &&
+           a.extent.width == b.extent.width && a.extent.height == b.extent.height;
+}
+
+static bool rect_inside(const VkRect2D& a, const VkRect2D& b)
+{
+    return a.offset.x >= b.offset.x && a.offset.y >= b.offset.y &&
+           a.offset.x + a.extent.width  <= b.offset.x + b.extent.width &&
+           a.offset.y + a.extent.height <= b.offset.y + b.extent.height;
+}
+
+static VkRect2D rect_union(const VkRect2D& a, const VkRect2D& b)
+{
+    int32_t x0 = std::min(a.offset.x, b.offset.x);
+    int32_t y0 = std::min(a.offset.y, b.offset.y);
+    int32_t x1 = std::max(a.offset.x + (int32_t)a.extent.width,  b.offset.x + (int32_t)b.extent.width);
+    int32_t y1 = std::max(a.offset.y + (int32_t)a.extent.height, b.offset.y + (int32_t)b.extent.height);
+    return { { x0, y0 }, { (uint32_t)(x1 - x0), (uint32_t)(y1 - y0) } };
+}
+
+static bool pixel_is_black(const uint8_t* p)
+{
+    return p[0] <= LetterboxDetector::kBlack && p[1] <= LetterboxDetector::kBlack &&
+           p[2] <= LetterboxDetector::kBlack;
+}
+
+// Every other pixel is plenty for a solid bar
+static bool row_is_black(const XImage* img, int y, int x0, int x1)
+{
+    const uint8_t* row = reinterpret_cast<const uint8_t*>(img->data) + (size_t)y * img->bytes_per_line;
+    for (int x = x0; x < x1; x += 2) {
+        if (!pixel_is_black(row + x * 4)) return false;
+    }
+    return true;
+}
+
+static bool column_is_black(const XImage* img, int x, int y0, int y1)
+{
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(img->data) + x * 4;
+    for (int y = y0; y < y1; y += 2) {
+        if (!pixel_is_black(base + (size_t)y * img->bytes_per_line)) return false;
+    }
+    return true;
+}
+
+// Non-black area of a full-window capture, as symmetric bars rounded down
+// to even sizes. Zero extent if the whole frame is black.
+VkRect2D detect_active_rect(const XImage* img, int w, int h)
+{
+    int top = 0, bottom = h;
+    while (top < h && row_is_black(img, top, 0, w)) ++top;
+    if (top == h) return {};
+    while (bottom > top && row_is_black(img, bottom - 1, 0, w)) --bottom;
+
+    int left = 0, right = w;
+    while (left < w && column_is_black(img, left, top, bottom)) ++left;
+    while (right > left && column_is_black(img, right - 1, top, bottom)) --right;
+
+    // Real bars come in pairs; an uneven black edge is more likely a dark
+    // part of the picture, so only the thinner side is trusted
+    int barY = std::min(top, h - bottom) & ~1;
+    int barX = std::min(left, w - right) & ~1;
+    if (barY < LetterboxDetector::kMinBar) barY = 0;
+    if (barX < LetterboxDetector::kMinBar) barX = 0;
+
+    return { { barX, barY }, { (uint32_t)(w - 2 * barX), (uint32_t)(h - 2 * barY) } };
+}
+
+// Feeds one probe result in; returns true if `active` changed
+bool letterbox_update(LetterboxDetector& lb, VkRect2D& active, const VkRect2D& detected)
+{
+    // Fades and loading screens say nothing about the bars
+    if (detected.extent.width == 0 || detected.extent.height == 0) return false;
+
+    if (!rect_inside(detected, active)) {
+        // Picture inside a bar we cut away: uncrop right away
+        active = rect_union(active, detected);
+        lb.agree = 0;
+        return true;
+    }
+    if (rect_equal(detected, active)) {
+        lb.agree = 0;
+        return false;
+    }
+
+    if (rect_equal(detected, lb.candidate)) {
+        lb.agree++;
+    } else {
+        lb.candidate = detected;
+        lb.agree = 1;
+    }
+    if (lb.agree < LetterboxDetector::kStableProbes) return false;
+
+    active = detected;
+    lb.agree = 0;
+    return true;
+}
+
+// Active rect in render space (the capture is scaled to renderExtent)
+VkExtent2D active_render_extent(const VulkanContext& vc)
+{
+    return {
+        std::max(1u, (uint32_t)((uint64_t)vc.activeRect.extent.width  * vc.renderExtent.width  / vc.captureExtent.width)),
+        std::max(1u, (uint32_t)((uint64_t)vc.activeRect.extent.height * vc.renderExtent.height / vc.captureExtent.height))
+    };
+}
+
+// Same place on the display as in the uncropped, stretched-to-fit picture
+void update_display_rect(VulkanContext& vc)
+{
+    if (!vc.captureExtent.width || !vc.captureExtent.height) {
+        vc.displayRect = { { 0, 0 }, vc.displayExtent };
+        return;
+    }
+    const uint64_t cw = vc.captureExtent.width, ch = vc.captureExtent.height;
+    const uint64_t dw = vc.displayExtent.width, dh = vc.displayExtent.height;
+    const uint64_t x0 = vc.activeRect.offset.x * dw / cw;
+    const uint64_t y0 = vc.activeRect.offset.y * dh / ch;
+    const uint64_t x1 = (vc.activeRect.offset.x + vc.activeRect.extent.width)  * dw / cw;
+    const uint64_t y1 = (vc.activeRect.offset.y + vc.activeRect.extent.height) * dh / ch;
+    vc.displayRect = { { (int32_t)x0, (int32_t)y0 },
+                       { (uint32_t)std::max<uint64_t>(x1 - x0, 1), (uint32_t)std::max<uint64_t>(y1 - y0, 1) } };
+}
+
+static bool display_cropped(const VulkanContext& vc)
+{
+    return vc.displayRect.extent.width  != vc.displayExtent.width ||
+           vc.displayRect.extent.height != vc.displayExtent.height;
+}
+
+/* ---------------- Tiled frame hash (duplicate frames) ---------------- */
+
+// Capped or stuttering games present the same image twice and XDamage
+// fires anyway because they redraw. Each capture is hashed per 64x64 tile
+// while it's copied into staging, so spotting a repeat costs no extra pass
+// over memory and the frame never reaches the GPU.
+struct FrameHashes {
+    static constexpr int kTile = 64;   // pixels, both directions
+
+    uint32_t tilesX = 0;
+    uint32_t tilesY = 0;
+    std::vector<uint64_t> tiles;       // this capture
+    std::vector<uint64_t> previous;    // last capture
+    std::vector<uint64_t> accum;       // 2 lanes per tile column, current tile row
+    bool previousValid = false;
+    uint32_t changedTiles = 0;
+};
+
+// Next capture is never a duplicate (new swapchain, new target, ...)
+void frame_hashes_invalidate(FrameHashes& fh)
+{
+    fh.previousValid = false;
+}
+
+// xxHash3-style accumulation: 16 bytes per step, two 64-bit lanes, each
+// lane adds a 32x32->64 product of its keyed input plus the other lane's
+// raw input. The key steps by kFrameHashKeyStep per block and the lanes are
+// scrambled after every tile row, so the hash depends on where things are,
+// not just on what is in the tile. SSE2 has everything needed for the
+// blocks, the scalar path is bit-identical.
+static const uint64_t kFrameHashKey[2] = { 0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL };
+static const uint64_t kFrameHashKeyStep[2] = { 0x9fb21c651e98df25ULL, 0x27d4eb2f165667c5ULL };
+static const uint64_t kFrameHashSeed[2] = { 0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL };
+
+// Block `index` of a tile row
+static inline void hash_fold_block(uint64_t* acc, const uint64_t* d, uint64_t index)
+{
+    for (int l = 0; l < 2; ++l) {
+        uint64_t dk = d[l] ^ (kFrameHashKey[l] + index * kFrameHashKeyStep[l]);
+        acc[l] += (dk & 0xffffffffULL) * (dk >> 32) + d[l ^ 1];
+    }
+}
+
+// End of a tile row (xxh3's accumulator scramble)
+static inline void hash_scramble(uint64_t* acc)
+{
+    for (int l = 0; l < 2; ++l) {
+        uint64_t a = acc[l];
+        a ^= a >> 47;
+        a ^= kFrameHashSeed[l];
+        acc[l] = a * 0x9E3779B1ULL;
+    }
+}
+
+// Copies one tile row, size bytes, from src to dst and folds it into acc[0..1]
+static void hash_copy_span(uint8_t* dst, const uint8_t* src, size_t size, uint64_t* acc)
+{
+    size_t blocks = size / 16;
+#if defined(__SSE2__)
+    const __m128i step = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kFrameHashKeyStep));
+    __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kFrameHashKey));
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc));
+    for (size_t i = 0; i < blocks; ++i) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src) + i);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + i, d);
+        __m128i dk = _mm_xor_si128(d, key);
+        __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+        a = _mm_add_epi64(a, _mm_add_epi64(prod, swapped));
+        key = _mm_add_epi64(key, step);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(acc), a);
+#else
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t d[2];
+        std::memcpy(d, src + i * 16, 16);
+        std::memcpy(dst + i * 16, d, 16);
+        hash_fold_block(acc, d, i);
+    }
+#endif
+
+    size_t tail = size - blocks * 16;
+    if (tail) {
+        // Zero-padded final block, folded in scalar
+        uint64_t d[2] = { 0, 0 };
+        std::memcpy(d, src + blocks * 16, tail);
+        std::memcpy(dst + blocks * 16, src + blocks * 16, tail);
+        hash_fold_block(acc, d, blocks);
+    }
+    hash_scramble(acc);
+}
+
+static uint64_t hash_finalize(const uint64_t* acc)
+{
+    uint64_t h = acc[0] ^ ((acc[1] << 31) | (acc[1] >> 33));
+    h ^= h >> 33;
+    h *= 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    h *= 0x165667B19E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static void frame_hashes_begin(FrameHashes& fh, int width, int height)
+{
+    uint32_t tx = (uint32_t)((width  + FrameHashes::kTile - 1) / FrameHashes::kTile);
+    uint32_t ty = (uint32_t)((height + FrameHashes::kTile - 1) / FrameHashes::kTile);
+    if (tx != fh.tilesX || ty != fh.tilesY) {
+        fh.tilesX = tx;
+        fh.tilesY = ty;
+        fh.previousValid = false;
+    }
+    fh.tiles.resize((size_t)tx * ty);
+    fh.accum.resize((size_t)tx * 2);
+}
+
+static void frame_hashes_reset_row(FrameHashes& fh)
+{
+    for (uint32_t x = 0; x < fh.tilesX; ++x) {
+        fh.accum[x * 2 + 0] = kFrameHashSeed[0];
+        fh.accum[x * 2 + 1] = kFrameHashSeed[1];
+    }
+}
+
+#ifndef NDEBUG
+// Hash of one w x h tile of BGRX pixels, as upload_capture_to_staging gets it
+static uint64_t hash_tile(const uint8_t* px, int stride, int w, int h)
+{
+    std::vector<uint8_t> scratch((size_t)w * 4);
+    uint64_t acc[2] = { kFrameHashSeed[0], kFrameHashSeed[1] };
+    for (int y = 0; y < h; ++y) {
+        hash_copy_span(scratch.data(), px + (size_t)y * stride, (size_t)w * 4, acc);
+    }
+    return hash_finalize(acc);
+}
+
+// Startup check: moving a 4 px block inside a tile, sideways or down, must
+// change its hash, and the SSE2 path must match the scalar one
+static void frame_hash_self_check()
+{
+    const int kTile = FrameHashes::kTile, stride = kTile * 4;
+    std::vector<uint8_t> a((size_t)kTile * stride, 0x20), b = a, c = a;
+    auto block = [&](std::vector<uint8_t>& img, int x, int y) {
+        for (int i = 0; i < 4 * 4; ++i) img[(size_t)y * stride + x * 4 + i] = 0xff;
+    };
+    block(a, 8, 10);
+    block(b, 12, 10);   // 4 px to the right
+    block(c, 8, 11);    // a row down
+    const uint64_t ha = hash_tile(a.data(), stride, kTile, kTile);
+    if (ha == hash_tile(b.data(), stride, kTile, kTile) ||
+        ha == hash_tile(c.data(), stride, kTile, kTile)) {
+        fatal("frame hash: moved block hashes like the original");
+    }
+
+    uint64_t acc[2] = { kFrameHashSeed[0], kFrameHashSeed[1] };
+    for (int y = 0; y < kTile; ++y) {
+        for (int i = 0; i < stride / 16; ++i) {
+            uint64_t d[2];
+            std::memcpy(d, &a[(size_t)y * stride + i * 16], 16);
+            hash_fold_block(acc, d, (uint64_t)i);
+        }
+        hash_scramble(acc);
+    }
+    if (hash_finalize(acc) != ha) fatal("frame hash: vector and scalar paths differ");
+}
+#endif
+
+// Compares against the previous capture and keeps this one for the next call.
+// Returns true if any tile changed.
+static bool frame_hashes_end(FrameHashes& fh)
+{
+    bool valid = fh.previousValid && fh.previous.size() == fh.tiles.size();
+    fh.changedTiles = 0;
+    for (size_t i = 0; i < fh.tiles.size(); ++i) {
+        if (!valid || fh.tiles[i] != fh.previous[i]) fh.changedTiles++;
+    }
+    std::swap(fh.tiles, fh.previous);
+    fh.previousValid = true;
+    return fh.changedTiles != 0;
+}
+
 /* --------- Upload capture buffer into staging buffer (CPU) -------- */
 
-void upload_capture_to_staging(
+// Returns false if the capture is identical to the previous one
+bool upload_capture_to_staging(
     const X11Context& xc,
     const CaptureBuffer& cb,
-    VulkanContext& vc)
+    VulkanContext& vc,
+    FrameHashes& hashes)
 {
-    void* mapped = nullptr;
-    vk_check(
-        vkMapMemory(vc.device, vc.stagingMemory, 0, vc.stagingSize, 0, &mapped),
-        "vkMapMemory staging"
-    );
-
-    auto* dst = static_cast<std::uint8_t*>(mapped);
+    TRACE_ZONE("staging copy");
+    auto* dst = static_cast<std::uint8_t*>(gpu_map(vc, vc.stagingMemory));
     auto* src = reinterpret_cast<std::uint8_t*>(cb.image->data);
 
-    // Clear whole staging to black (prevents garbage borders)
-    std::memset(dst, 0, (size_t)vc.stagingSize);
-
     const int srcStride = cb.image->bytes_per_line;
 
-    const int width  = std::min<int>((int)vc.captureExtent.width,  cb.image->width);
-    const int height = std::min<int>((int)vc.captureExtent.height, cb.image->height);
+    // Active rect only; the capture may be the whole window (letterbox probe)
+    const int srcX = std::max(0, vc.activeRect.offset.x - cb.originX);
+    const int srcY = std::max(0, vc.activeRect.offset.y - cb.originY);
+    src += (size_t)srcY * srcStride + (size_t)srcX * 4;
+
+    const int width  = std::max(0, std::min<int>((int)vc.activeRect.extent.width,  cb.image->width  - srcX));
+    const int height = std::max(0, std::min<int>((int)vc.activeRect.extent.height, cb.image->height - srcY));
 
     const int dstStride      = (int)vc.captureExtent.width * 4;
     const int copyWidthBytes = width * 4;
+    const int tileBytes      = FrameHashes::kTile * 4;
+
+    frame_hashes_begin(hashes, width, height);
 
     for (int y = 0; y < height; ++y) {
-        std::memcpy(
-            dst + y * dstStride,
-            src + y * srcStride,
-            copyWidthBytes
-        );
+        if (y % FrameHashes::kTile == 0) frame_hashes_reset_row(hashes);
+
+        uint8_t* dstRow = dst + (size_t)y * dstStride;
+        const uint8_t* srcRow = src + (size_t)y * srcStride;
+        for (uint32_t tx = 0; tx < hashes.tilesX; ++tx) {
+            int begin = (int)tx * tileBytes;
+            int end = std::min(begin + tileBytes, copyWidthBytes);
+            hash_copy_span(dstRow + begin, srcRow + begin, (size_t)(end - begin), &hashes.accum[tx * 2]);
+        }
+        // Black right border, rather than clearing all of staging up front
+        if (dstStride > copyWidthBytes) {
+            std::memset(dstRow + copyWidthBytes, 0, (size_t)(dstStride - copyWidthBytes));
+        }
+
+        if (y % FrameHashes::kTile == FrameHashes::kTile - 1 || y == height - 1) {
+            uint32_t ty = (uint32_t)(y / FrameHashes::kTile);
+            for (uint32_t tx = 0; tx < hashes.tilesX; ++tx) {
+                hashes.tiles[ty * hashes.tilesX + tx] = hash_finalize(&hashes.accum[tx * 2]);
+            }
+        }
+    }
+
+    // Black bottom border (and garbage-free staging when the capture is small)
+    size_t written = (size_t)height * dstStride;
+    if (written < (size_t)vc.stagingSize) {
+        std::memset(dst + written, 0, (size_t)vc.stagingSize - written);
     }
 
-    vkUnmapMemory(vc.device, vc.stagingMemory);
+    return frame_hashes_end(hashes);
 }
 
 
@@ -702,7 +2926,8 @@ void create_image(
     VkFormat format,
     VkImageUsageFlags usage,
     VkImage& image,
-    VkDeviceMemory& memory)
+    GpuAllocation& memory,
+    AllocStrategy strategy = AllocStrategy::Buddy)
 {
     VkImageCreateInfo ici{};
     ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -718,21 +2943,7 @@ void create_image(
     ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
     vk_check(vkCreateImage(vc.device, &ici, nullptr, &image), "vkCreateImage");
-
-    VkMemoryRequirements memReq{};
-    vkGetImageMemoryRequirements(vc.device, image, &memReq);
-
-    VkMemoryAllocateInfo mai{};
-    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mai.allocationSize = memReq.size;
-    mai.memoryTypeIndex = findMemoryType(
-        vc.physDevice,
-        memReq.memoryTypeBits,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-    );
-
-    vk_check(vkAllocateMemory(vc.device, &mai, nullptr, &memory), "vkAllocateMemory");
-    vk_check(vkBindImageMemory(vc.device, image, memory, 0), "vkBindImageMemory");
+    memory = gpu_alloc_image(vc, image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, strategy);
 }
 
 // 2. Create image view
@@ -758,24 +2969,9 @@ VkImageView create_image_view(
     return view;
 }
 
-// 3. Create all FSR-required images
-void create_fsr_images(VulkanContext& vc)
+// 3a. Output color image (upscaled result), the only one sized by the display
+void create_output_image(VulkanContext& vc)
 {
-    // Input color image (low-res captured content)
-    create_image(
-        vc,
-        vc.renderExtent.width,
-        vc.renderExtent.height,
-        VK_FORMAT_B8G8R8A8_UNORM,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        vc.inputColorImage,
-        vc.inputColorMemory
-    );
-    vc.inputColorView = create_image_view(
-        vc, vc.inputColorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT
-    );
-
-    // Output color image (upscaled result)
     create_image(
         vc,
         vc.displayExtent.width,
@@ -788,49 +2984,253 @@ void create_fsr_images(VulkanContext& vc)
     vc.outputColorView = create_image_view(
         vc, vc.outputColorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT
     );
+}
 
-    // Motion vectors (optional but improves quality)
+void destroy_output_image(VulkanContext& vc)
+{
+    if (vc.outputColorView) vkDestroyImageView(vc.device, vc.outputColorView, nullptr);
+    if (vc.outputColorImage) vkDestroyImage(vc.device, vc.outputColorImage, nullptr);
+    gpu_free(vc, vc.outputColorMemory);
+    vc.outputColorView   = VK_NULL_HANDLE;
+    vc.outputColorImage  = VK_NULL_HANDLE;
+}
+
+void create_motion_resources(VulkanContext& vc);
+void destroy_motion_resources(VulkanContext& vc);
+void create_spatial_resources(VulkanContext& vc);
+void destroy_spatial_resources(VulkanContext& vc);
+void create_foveation_resources(VulkanContext& vc);
+void destroy_foveation_resources(VulkanContext& vc);
+
+// 3b. Create all FSR-required images sized by the capture (per session).
+// They all go at session end, so they are allocated linearly.
+void create_fsr_images(VulkanContext& vc)
+{
+    // Input color image (low-res captured content). At 1:1 it is also the
+    // upload target and the source of the blit fallback; foveation copies
+    // its ROI out.
+    const bool separateCapture = vc.renderExtent.width  != vc.captureExtent.width ||
+                                 vc.renderExtent.height != vc.captureExtent.height;
     create_image(
         vc,
         vc.renderExtent.width,
         vc.renderExtent.height,
-        VK_FORMAT_R16G16_SFLOAT,
-        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-        vc.motionVectorImage,
-        vc.motionVectorMemory
+        VK_FORMAT_B8G8R8A8_UNORM,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        vc.inputColorImage,
+        vc.inputColorMemory,
+        AllocStrategy::Linear
     );
-    vc.motionVectorView = create_image_view(
-        vc, vc.motionVectorImage, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT
+    vc.inputColorView = create_image_view(
+        vc, vc.inputColorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT
     );
+    vc.inputColorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-    // Depth buffer (optional)
+    // Motion vectors, written by the motion estimation pass
     create_image(
         vc,
         vc.renderExtent.width,
         vc.renderExtent.height,
-        VK_FORMAT_D32_SFLOAT,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        vc.depthImage,
-        vc.depthMemory
+        VK_FORMAT_R16G16_SFLOAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        vc.motionVectorImage,
+        vc.motionVectorMemory,
+        AllocStrategy::Linear
     );
-    vc.depthView = create_image_view(
-        vc, vc.depthImage, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT
+    vc.motionVectorView = create_image_view(
+        vc, vc.motionVectorImage, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT
     );
+    vc.motionVectorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // Depth: FSR wants one, the spatial scaler never reads it
+    if (!vc.spatial.enabled) {
+        create_image(
+            vc,
+            vc.renderExtent.width,
+            vc.renderExtent.height,
+            VK_FORMAT_D32_SFLOAT,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            vc.depthImage,
+            vc.depthMemory,
+            AllocStrategy::Linear
+        );
+        vc.depthView = create_image_view(
+            vc, vc.depthImage, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT
+        );
+        vc.depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
 
-    create_image(
-        vc,
-        vc.captureExtent.width,
-        vc.captureExtent.height,
-        VK_FORMAT_B8G8R8A8_UNORM,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-        vc.captureColorImage,
-        vc.captureColorMemory
-    );
+    if (separateCapture) {
+        create_image(
+            vc,
+            vc.captureExtent.width,
+            vc.captureExtent.height,
+            VK_FORMAT_B8G8R8A8_UNORM,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            vc.captureColorImage,
+            vc.captureColorMemory,
+            AllocStrategy::Linear
+        );
+    }
+
+    create_motion_resources(vc);
+    if (vc.spatial.enabled) create_spatial_resources(vc);
+    else if (vc.foveation.mode != Foveation::Mode::Off) create_foveation_resources(vc);
+}
+
+// 4. FSR context cache (LRU)
+static bool fsr_key_fits(const FSRContextKey& have, const FSRContextKey& want)
+{
+    return have.flags == want.flags &&
+           have.maxRenderSize.width   >= want.maxRenderSize.width &&
+           have.maxRenderSize.height  >= want.maxRenderSize.height &&
+           have.maxUpscaleSize.width  >= want.maxUpscaleSize.width &&
+           have.maxUpscaleSize.height >= want.maxUpscaleSize.height;
+}
+
+// Takes the smallest cached context that can serve `want` out of the cache.
+// `got` receives the key it was really created with.
+ffx::Context fsr_cache_take(FSRContextCache& cache, const FSRContextKey& want, FSRContextKey& got)
+{
+    auto best = cache.entries.end();
+    uint64_t bestArea = UINT64_MAX;
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+        if (!fsr_key_fits(it->key, want)) continue;
+        uint64_t area = (uint64_t)it->key.maxUpscaleSize.width * it->key.maxUpscaleSize.height +
+                        (uint64_t)it->key.maxRenderSize.width  * it->key.maxRenderSize.height;
+        if (area < bestArea) {
+            bestArea = area;
+            best = it;
+        }
+    }
+
+    if (best == cache.entries.end()) return nullptr;
+
+    ffx::Context ctx = best->context;
+    got = best->key;
+    cache.entries.erase(best);
+    return ctx;
+}
+
+// Parks an idle context, evicting the least recently used beyond capacity
+void fsr_cache_put(FSRContextCache& cache, const FSRContextKey& key, ffx::Context ctx)
+{
+    if (!ctx) return;
+
+    FSRContextCache::Entry e;
+    e.key = key;
+    e.context = ctx;
+    e.lastUse = ++cache.useClock;
+    cache.entries.push_back(e);
+
+    while (cache.entries.size() > cache.capacity) {
+        auto lru = std::min_element(
+            cache.entries.begin(), cache.entries.end(),
+            [](const FSRContextCache::Entry& a, const FSRContextCache::Entry& b) {
+                return a.lastUse < b.lastUse;
+            });
+        ffx::DestroyContext(lru->context);
+        cache.entries.erase(lru);
+    }
+}
+
+void fsr_cache_clear(FSRContextCache& cache)
+{
+    for (auto& e : cache.entries) {
+        ffx::DestroyContext(e.context);
+    }
+    cache.entries.clear();
+}
+
+static uint32_t fsr_context_flags()
+{
+#ifndef NDEBUG
+    // Highly recommended while bringing it up, but it costs GPU time
+    return FFX_UPSCALE_ENABLE_DEBUG_CHECKING;
+#else
+    return 0;
+#endif
+}
+
+// 5a. Background context creation. The worker only touches its own
+// descriptors and the job slot; the main thread parks the result.
+void start_fsr_init_async(VulkanContext& vc, FSRContext& fc, const FSRContextKey& key)
+{
+    // One job at a time, initFSR() asks again once it has landed
+    if (fc.pending.worker.joinable()) return;
+
+    FSRAsyncInit* job = &fc.pending;
+    job->done.store(false, std::memory_order_relaxed);
+    job->key = key;
+    job->context = nullptr;
+
+    VkDevice device = vc.device;
+    VkPhysicalDevice phys = vc.physDevice;
+    bool warmCache = vc.pipelineCacheWarm;
+
+    job->worker = std::thread([job, device, phys, warmCache]() {
+        trace_thread_name("fsr-init");
+        TRACE_ZONE("FSR CreateContext");
+        ffx::CreateBackendVKDesc backendDesc{};
+        backendDesc.header.type      = FFX_API_CREATE_CONTEXT_DESC_TYPE_BACKEND_VK;
+        backendDesc.vkDevice         = device;
+        backendDesc.vkPhysicalDevice = phys;
+        backendDesc.vkDeviceProcAddr = ffx_get_device_proc_addr;
+
+        ffx::CreateContextDescUpscale createFsr{};
+        createFsr.header.type    = FFX_API_CREATE_CONTEXT_DESC_TYPE_UPSCALE;
+        createFsr.maxRenderSize  = job->key.maxRenderSize;
+        createFsr.maxUpscaleSize = job->key.maxUpscaleSize;
+        createFsr.flags          = job->key.flags;
+
+        ffx::Context ctx = nullptr;
+        auto t0 = std::chrono::steady_clock::now();
+        ffx::ReturnCode rc = ffx::CreateContext(ctx, nullptr, createFsr, backendDesc);
+        if (!rc || !ctx) {
+            fprintf(stderr, "CreateContext failed: %d\n", (int)rc);
+            ctx = nullptr;
+        } else {
+            // Startup metric: compare cold vs warm pipeline cache runs
+            std::printf("FSR context created in %.1f ms (background, %s pipeline cache)\n",
+                        std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - t0).count(),
+                        warmCache ? "warm" : "cold");
+        }
+
+        job->context = ctx;
+        job->done.store(true, std::memory_order_release);
+    });
+}
+
+// Parks a finished background context in the cache. Returns true when a new
+// context became available; `wait` blocks on a running job (shutdown).
+bool poll_fsr_init_async(FSRContext& fc, bool wait = false)
+{
+    if (!fc.pending.worker.joinable()) return false;
+    if (!wait && !fc.pending.done.load(std::memory_order_acquire)) return false;
+
+    fc.pending.worker.join();
+    if (!fc.pending.context) return false;
+
+    fsr_cache_put(fc.cache, fc.pending.key, fc.pending.context);
+    fc.pending.context = nullptr;
+    return true;
 }
 
-// 4. Initialize FSR context properly
+// 5b. Initialize FSR context properly. Takes a cached context when one fits,
+// otherwise queues background creation and leaves the context null: frames
+// go through the blit path until poll_fsr_init_async() reports it ready.
 void initFSR(VulkanContext& vc, FSRContext& fc) 
 {
+    // The spatial scaler has no context to create, only history to drop
+    if (vc.spatial.enabled) {
+        fc.resetHistory = true;
+        return;
+    }
+
     fc.backendDesc = {};
     fc.createFsr   = {};
 
@@ -840,95 +3240,194 @@ void initFSR(VulkanContext& vc, FSRContext& fc)
     fc.backendDesc.header.type     = FFX_API_CREATE_CONTEXT_DESC_TYPE_BACKEND_VK;
     fc.backendDesc.vkDevice        = vc.device;
     fc.backendDesc.vkPhysicalDevice= vc.physDevice;
-    fc.backendDesc.vkDeviceProcAddr= vkGetDeviceProcAddr;
+    fc.backendDesc.vkDeviceProcAddr= ffx_get_device_proc_addr;
 
     fc.createFsr.header.type       = FFX_API_CREATE_CONTEXT_DESC_TYPE_UPSCALE;
     fc.createFsr.maxUpscaleSize    = { vc.displayExtent.width, vc.displayExtent.height };
     fc.createFsr.maxRenderSize     = { vc.renderExtent.width,  vc.renderExtent.height  };
-
-    // Highly recommended while bringing it up:
-    fc.createFsr.flags = FFX_UPSCALE_ENABLE_DEBUG_CHECKING; // + whatever else you need
+    fc.createFsr.flags             = fsr_context_flags();
     // fc.createFsr.fpMessage = &YourFfxMsgCallback;         // to see WHY it fails
 
-    fc.retCodeCreate = ffx::CreateContext(fc.m_UpscalingContext, nullptr, fc.createFsr, fc.backendDesc);
-    if (!fc.retCodeCreate || !fc.m_UpscalingContext) {
-    fprintf(stderr, "CreateContext failed: %d\n", (int)fc.retCodeCreate);
-    return;
+    fc.resetHistory = true;
+
+    FSRContextKey want{ fc.createFsr.maxRenderSize, fc.createFsr.maxUpscaleSize, fc.createFsr.flags };
+    FSRContextKey got{};
+    fc.m_UpscalingContext = fsr_cache_take(fc.cache, want, got);
+    if (fc.m_UpscalingContext) {
+        // Keep the sizes it was really created for, fsr_context_fits() checks them
+        fc.createFsr.maxRenderSize  = got.maxRenderSize;
+        fc.createFsr.maxUpscaleSize = got.maxUpscaleSize;
+        std::printf("FSR context reused (%ux%u -> %ux%u)\n",
+                    got.maxRenderSize.width, got.maxRenderSize.height,
+                    got.maxUpscaleSize.width, got.maxUpscaleSize.height);
+        return;
+    }
+
+    start_fsr_init_async(vc, fc, want);
 }
+
+// Parks the active context in the cache; fsr_cache_clear() really frees it
+void release_fsr_context(FSRContext& fc)
+{
+    if (fc.m_UpscalingContext) {
+        FSRContextKey key{ fc.createFsr.maxRenderSize, fc.createFsr.maxUpscaleSize, fc.createFsr.flags };
+        fsr_cache_put(fc.cache, key, fc.m_UpscalingContext);
+        fc.m_UpscalingContext = nullptr;
+    }
 }
 
-// 5. Transition image layout helper
-void transition_image_layout(
+// The context is created for max sizes, anything that fits can keep using it
+bool fsr_context_fits(const VulkanContext& vc, const FSRContext& fc)
+{
+    return fc.m_UpscalingContext &&
+           vc.displayExtent.width  <= fc.createFsr.maxUpscaleSize.width &&
+           vc.displayExtent.height <= fc.createFsr.maxUpscaleSize.height &&
+           vc.renderExtent.width   <= fc.createFsr.maxRenderSize.width &&
+           vc.renderExtent.height  <= fc.createFsr.maxRenderSize.height;
+}
+
+// 6. Barriers. Every pass leaves an image in the layout of its use, so the
+// layout on either side of a transition says which stages and accesses the
+// barrier has to order: no table of known pairs, no full-pipeline fallback.
+// Transitions recorded back to back go out as one vkCmdPipelineBarrier.
+
+// Stages that wait on the acquire semaphore; the first barrier on a
+// swapchain image has to chain to them (see acquire_swap_image)
+static const VkPipelineStageFlags kAcquireWaitStages =
+    VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+// Stages and accesses of the use a layout stands for. As a source only
+// writes need making available; reads just need to finish.
+static void layout_scope(VkImageLayout layout, bool asSource,
+                         VkPipelineStageFlags& stage, VkAccessFlags& access)
+{
+    switch (layout) {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+        stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        access = 0;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        access = VK_ACCESS_TRANSFER_WRITE_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        access = asSource ? 0 : VK_ACCESS_TRANSFER_READ_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        access = asSource ? 0 : VK_ACCESS_SHADER_READ_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_GENERAL:
+        // Storage images: compute reads and writes them
+        stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        access = asSource ? VK_ACCESS_SHADER_WRITE_BIT
+                          : VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+        // The present semaphore makes the writes visible
+        stage = asSource ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        access = 0;
+        break;
+    default:
+        stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        access = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        break;
+    }
+}
+
+struct BarrierBatch {
+    static constexpr uint32_t kMax = 8;
+    VkImageMemoryBarrier images[kMax];
+    uint32_t count = 0;
+    VkPipelineStageFlags srcStages = 0;
+    VkPipelineStageFlags dstStages = 0;
+};
+
+void barrier_flush(VkCommandBuffer cmd, BarrierBatch& batch)
+{
+    if (batch.count == 0) return;
+    vkCmdPipelineBarrier(cmd, batch.srcStages, batch.dstStages, 0,
+                         0, nullptr, 0, nullptr, batch.count, batch.images);
+    batch.count = 0;
+    batch.srcStages = 0;
+    batch.dstStages = 0;
+}
+
+// `after` adds source stages the layout doesn't imply, e.g. the acquire
+// semaphore's wait stages for a swapchain image
+void barrier_add(
     VkCommandBuffer cmd,
+    BarrierBatch& batch,
     VkImage image,
     VkImageLayout oldLayout,
     VkImageLayout newLayout,
-    VkImageAspectFlags aspectMask)
+    VkImageAspectFlags aspectMask,
+    VkPipelineStageFlags after = 0)
 {
-    VkImageMemoryBarrier barrier{};
+    if (batch.count == BarrierBatch::kMax) barrier_flush(cmd, batch);
+
+    VkPipelineStageFlags srcStage, dstStage;
+    VkAccessFlags srcAccess, dstAccess;
+    layout_scope(oldLayout, true, srcStage, srcAccess);
+    layout_scope(newLayout, false, dstStage, dstAccess);
+
+    VkImageMemoryBarrier& barrier = batch.images[batch.count++];
+    barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
     barrier.oldLayout = oldLayout;
     barrier.newLayout = newLayout;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
-    barrier.subresourceRange.aspectMask = aspectMask;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange = { aspectMask, 0, 1, 0, 1 };
 
-    VkPipelineStageFlags srcStage, dstStage;
+    batch.srcStages |= srcStage | after;
+    batch.dstStages |= dstStage;
+}
 
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && 
-        newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && 
-               newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && 
-               newLayout == VK_IMAGE_LAYOUT_GENERAL) {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-        newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-
-    } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL &&
-            newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-
-    } else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
-            newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        srcStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT; // good enough for your pipeline
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    } else {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = 0;
-        srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
-        dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
-    }
+// One transition on its own
+void transition_image_layout(
+    VkCommandBuffer cmd,
+    VkImage image,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    VkImageAspectFlags aspectMask)
+{
+    BarrierBatch batch;
+    barrier_add(cmd, batch, image, oldLayout, newLayout, aspectMask);
+    barrier_flush(cmd, batch);
+}
 
-    vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+// First use of an acquired swapchain image this frame
+void acquire_swap_image(VkCommandBuffer cmd, VkImage swapImg, VkImageLayout newLayout)
+{
+    BarrierBatch batch;
+    barrier_add(cmd, batch, swapImg, VK_IMAGE_LAYOUT_UNDEFINED, newLayout,
+                VK_IMAGE_ASPECT_COLOR_BIT, kAcquireWaitStages);
+    barrier_flush(cmd, batch);
+}
+
+// The depth input is constant (no scene depth to be had): far plane,
+// written the first time FSR runs on this image and then left alone
+void record_depth_clear_once(VulkanContext& vc, VkCommandBuffer cmd)
+{
+    if (!vc.depthImage || vc.depthLayout != VK_IMAGE_LAYOUT_UNDEFINED) return;
+
+    transition_image_layout(cmd, vc.depthImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+    VkClearDepthStencilValue farPlane{ 1.0f, 0 };
+    VkImageSubresourceRange range{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+    vkCmdClearDepthStencilImage(cmd, vc.depthImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                &farPlane, 1, &range);
+    transition_image_layout(cmd, vc.depthImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+    vc.depthLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
-// 6. Dispatch FSR upscaling
+// 7. Dispatch FSR upscaling
 static FfxApiSurfaceFormat vk_to_ffx_surface_format(VkFormat fmt) {
     switch (fmt) {
         case VK_FORMAT_B8G8R8A8_UNORM:   return FFX_API_SURFACE_FORMAT_B8G8R8A8_UNORM;
@@ -966,7 +3465,10 @@ static FfxApiResource make_ffx_api_resource_vk(
 
 }
 
-void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float jitterX, float jitterY, float deltaTime)
+// swapIndex >= 0 writes the upscale straight into that swapchain image
+// (GENERAL layout, see swap_direct_usable) instead of outputColorImage.
+void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float jitterX, float jitterY, float deltaTime,
+                  int swapIndex)
 {
     if (!fc.m_UpscalingContext) return;
 
@@ -976,10 +3478,17 @@ void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float
 
     fc.dispatchUpscale.commandList = cmd;
 
+    // Foveated: FSR only sees the region of interest, copied to the origin
+    // of its own images by record_foveation_inputs()
+    const Foveation& fv = vc.foveation;
+    const VkExtent2D inputSize = fv.active ? fv.renderCapacity : vc.renderExtent;
+    const VkExtent2D outputSize = fv.active ? fv.displayCapacity : vc.displayExtent;
+
     // Inputs (render resolution)
     fc.dispatchUpscale.color = make_ffx_api_resource_vk(
-        vc.inputColorImage, vc.inputColorView, VK_FORMAT_B8G8R8A8_UNORM,
-        vc.renderExtent.width, vc.renderExtent.height,
+        fv.active ? fv.colorImage : vc.inputColorImage,
+        fv.active ? fv.colorView : vc.inputColorView, VK_FORMAT_B8G8R8A8_UNORM,
+        inputSize.width, inputSize.height,
         FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
         "LS_InputColor"
     );
@@ -992,8 +3501,9 @@ void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float
     );
 
     fc.dispatchUpscale.motionVectors = make_ffx_api_resource_vk(
-        vc.motionVectorImage, vc.motionVectorView, VK_FORMAT_R16G16_SFLOAT,
-        vc.renderExtent.width, vc.renderExtent.height,
+        fv.active ? fv.motionImage : vc.motionVectorImage,
+        fv.active ? fv.motionView : vc.motionVectorView, VK_FORMAT_R16G16_SFLOAT,
+        inputSize.width, inputSize.height,
         FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
         "LS_MotionVectors"
     );
@@ -1004,24 +3514,43 @@ void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float
     fc.dispatchUpscale.transparencyAndComposition = {};
 
     // Output (presentation resolution). Mark as UAV-capable if your SDK uses usage flags.
-    fc.dispatchUpscale.output = make_ffx_api_resource_vk(
-        vc.outputColorImage, vc.outputColorView, VK_FORMAT_B8G8R8A8_UNORM,
-        vc.displayExtent.width, vc.displayExtent.height,
-        FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
-        "LS_OutputColor",
-        FFX_API_RESOURCE_USAGE_UAV
-    );
+    if (swapIndex >= 0) {
+        fc.dispatchUpscale.output = make_ffx_api_resource_vk(
+            vc.swapImages[swapIndex], vc.swapViews[swapIndex], vc.swapViewFormat,
+            vc.swapExtent.width, vc.swapExtent.height,
+            FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
+            "LS_SwapchainOutput",
+            FFX_API_RESOURCE_USAGE_UAV
+        );
+    } else {
+        fc.dispatchUpscale.output = make_ffx_api_resource_vk(
+            fv.active ? fv.outputImage : vc.outputColorImage,
+            fv.active ? fv.outputView : vc.outputColorView, VK_FORMAT_B8G8R8A8_UNORM,
+            outputSize.width, outputSize.height,
+            FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
+            "LS_OutputColor",
+            FFX_API_RESOURCE_USAGE_UAV
+        );
+    }
 
     // Jitter (note the sign convention in the SDK docs)
     fc.dispatchUpscale.jitterOffset.x = -jitterX;
     fc.dispatchUpscale.jitterOffset.y = -jitterY;
 
-    // If motion vectors are in pixels, scale is render resolution (as shown in SDK examples)
+    // Vectors are in UV units of the full input (ROI copies included); FSR
+    // divides the scale by the render size
     fc.dispatchUpscale.motionVectorScale.x = (float)vc.renderExtent.width;
     fc.dispatchUpscale.motionVectorScale.y = (float)vc.renderExtent.height;
 
-    fc.dispatchUpscale.renderSize  = { vc.renderExtent.width,  vc.renderExtent.height };
-    fc.dispatchUpscale.upscaleSize = { vc.displayExtent.width, vc.displayExtent.height };
+    // Letterbox crop: only the active part, at the origin of every image
+    const VkExtent2D activeRender = active_render_extent(vc);
+    if (fv.active) {
+        fc.dispatchUpscale.renderSize  = { fv.renderRoi.extent.width,  fv.renderRoi.extent.height };
+        fc.dispatchUpscale.upscaleSize = { fv.displayRoi.extent.width, fv.displayRoi.extent.height };
+    } else {
+        fc.dispatchUpscale.renderSize  = { activeRender.width, activeRender.height };
+        fc.dispatchUpscale.upscaleSize = { vc.displayRect.extent.width, vc.displayRect.extent.height };
+    }
 
     // Sharpening (optional)
     fc.dispatchUpscale.enableSharpening = false;
@@ -1032,8 +3561,7 @@ void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float
 
     // If you don't have real camera/depth info, these are best-effort placeholders.
     fc.dispatchUpscale.preExposure             = 1.0f;
-    static bool s_firstFrame = true;
-    fc.dispatchUpscale.reset                   = s_firstFrame;
+    fc.dispatchUpscale.reset                   = fc.resetHistory;
     fc.dispatchUpscale.cameraNear              = 0.1f;
     fc.dispatchUpscale.cameraFar               = 1000.0f;
     fc.dispatchUpscale.cameraFovAngleVertical  = 1.0f;   // ~57 degrees
@@ -1045,163 +3573,1631 @@ void dispatch_fsr(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd, float
         fprintf(stderr, "ffx::Dispatch(UPSCALE) failed: %d\n", (int)rc);
     }
 
-    s_firstFrame = false;
+    fc.resetHistory = false;
 }
 
-// 7. Cleanup FSR resources
+// 8. Cleanup per-session FSR resources. The context goes back to the cache
+// and the display-sized output image stays with the device.
 void cleanup_fsr(VulkanContext& vc, FSRContext& fc)
 {
-    if (fc.m_UpscalingContext) {
-        ffx::DestroyContext(fc.m_UpscalingContext);
-        fc.m_UpscalingContext = nullptr;
-    }
+    release_fsr_context(fc);
     
     if (vc.inputColorView) vkDestroyImageView(vc.device, vc.inputColorView, nullptr);
     if (vc.inputColorImage) vkDestroyImage(vc.device, vc.inputColorImage, nullptr);
-    if (vc.inputColorMemory) vkFreeMemory(vc.device, vc.inputColorMemory, nullptr);
-    
-    if (vc.outputColorView) vkDestroyImageView(vc.device, vc.outputColorView, nullptr);
-    if (vc.outputColorImage) vkDestroyImage(vc.device, vc.outputColorImage, nullptr);
-    if (vc.outputColorMemory) vkFreeMemory(vc.device, vc.outputColorMemory, nullptr);
-    
+    gpu_free(vc, vc.inputColorMemory);
+    vc.inputColorView   = VK_NULL_HANDLE;
+    vc.inputColorImage  = VK_NULL_HANDLE;
+
+    destroy_motion_resources(vc);
+    destroy_spatial_resources(vc);
+    destroy_foveation_resources(vc);
+
     if (vc.motionVectorView) vkDestroyImageView(vc.device, vc.motionVectorView, nullptr);
     if (vc.motionVectorImage) vkDestroyImage(vc.device, vc.motionVectorImage, nullptr);
-    if (vc.motionVectorMemory) vkFreeMemory(vc.device, vc.motionVectorMemory, nullptr);
+    gpu_free(vc, vc.motionVectorMemory);
+    vc.motionVectorView   = VK_NULL_HANDLE;
+    vc.motionVectorImage  = VK_NULL_HANDLE;
     
     if (vc.depthView) vkDestroyImageView(vc.device, vc.depthView, nullptr);
     if (vc.depthImage) vkDestroyImage(vc.device, vc.depthImage, nullptr);
-    if (vc.depthMemory) vkFreeMemory(vc.device, vc.depthMemory, nullptr);
+    gpu_free(vc, vc.depthMemory);
+    vc.depthView   = VK_NULL_HANDLE;
+    vc.depthImage  = VK_NULL_HANDLE;
+    vc.depthLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
     if (vc.captureColorImage)  vkDestroyImage(vc.device, vc.captureColorImage, nullptr);
-    if (vc.captureColorMemory) vkFreeMemory(vc.device, vc.captureColorMemory, nullptr);
+    gpu_free(vc, vc.captureColorMemory);
     vc.captureColorImage  = VK_NULL_HANDLE;
-    vc.captureColorMemory = VK_NULL_HANDLE;
 }
 
-/* --------- Record copy from staging buffer to swapchain image -------- */
+/* ---------------------- Motion estimation ----------------------- */
 
-// Replace your record_copy_to_swap_image function with this enhanced version
-void record_upscale_and_present(
-    VulkanContext& vc,
-    FSRContext& fc,
-    uint32_t imageIndex,
-    float deltaTime,
-    uint32_t frameCount)
+static void create_pyramid_level(VulkanContext& vc, PyramidLevel& lvl, VkExtent2D extent, VkFormat format)
 {
-    VkCommandBuffer cmd = vc.cmdBuffers[imageIndex];
-    vk_check(vkResetCommandBuffer(cmd, 0), "vkResetCommandBuffer");
+    lvl.extent = extent;
+    create_image(vc, extent.width, extent.height, format,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 lvl.image, lvl.memory, AllocStrategy::Linear);
+    lvl.view = create_image_view(vc, lvl.image, format, VK_IMAGE_ASPECT_COLOR_BIT);
+}
 
-    VkCommandBufferBeginInfo bi{};
-    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vk_check(vkBeginCommandBuffer(cmd, &bi), "vkBeginCommandBuffer");
+static void destroy_pyramid_level(VulkanContext& vc, PyramidLevel& lvl)
+{
+    if (lvl.view) vkDestroyImageView(vc.device, lvl.view, nullptr);
+    if (lvl.image) vkDestroyImage(vc.device, lvl.image, nullptr);
+    gpu_free(vc, lvl.memory);
+    lvl = PyramidLevel{};
+}
+
+// Render-sized pyramids and the per-level descriptor sets that point at
+// them. Needs inputColorView and motionVectorView.
+void create_motion_resources(VulkanContext& vc)
+{
+    MotionEstimator& me = vc.motion;
+    const uint32_t block = (uint32_t)me.params.blockSize;
+
+    // Stop before a level gets smaller than a single block
+    std::vector<VkExtent2D> extents{ vc.renderExtent };
+    while ((int)extents.size() < me.params.levels) {
+        VkExtent2D e{ (extents.back().width + 1) / 2, (extents.back().height + 1) / 2 };
+        if (e.width < block || e.height < block) break;
+        extents.push_back(e);
+    }
+    me.levelCount = (uint32_t)extents.size();
+
+    for (int p = 0; p < 2; ++p) {
+        me.luma[p].resize(me.levelCount);
+        for (uint32_t l = 0; l < me.levelCount; ++l) {
+            create_pyramid_level(vc, me.luma[p][l], extents[l], VK_FORMAT_R32_SFLOAT);
+        }
+    }
+    // Level 0 vectors go straight to motionVectorImage; a single-level
+    // setup still gets one image to bind as its (unused) predictor.
+    me.vectors.resize(std::max(me.levelCount, 2u));
+    for (uint32_t l = 1; l < me.vectors.size(); ++l) {
+        VkExtent2D e = l < me.levelCount ? extents[l] : extents[0];
+        create_pyramid_level(vc, me.vectors[l], e, VK_FORMAT_R16G16_SFLOAT);
+    }
+
+    const VkDescriptorType sampled = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    const VkDescriptorType storage = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    for (uint32_t p = 0; p < 2; ++p) {
+        for (uint32_t l = 0; l < me.levelCount; ++l) {
+            uint32_t idx = p * (uint32_t)me.params.levels + l;
+
+            VkDescriptorSet ds = me.downsamplePass.sets[idx];
+            if (l == 0) {
+                write_image_descriptor(vc, ds, 0, sampled, vc.inputColorView,
+                                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            } else {
+                write_image_descriptor(vc, ds, 0, sampled, me.luma[p][l - 1].view,
+                                       VK_IMAGE_LAYOUT_GENERAL);
+            }
+            write_image_descriptor(vc, ds, 1, storage, me.luma[p][l].view, VK_IMAGE_LAYOUT_GENERAL);
+
+            // Set for "current pyramid is p"
+            VkDescriptorSet ss = me.searchPass.sets[idx];
+            uint32_t coarser = std::min(l + 1, (uint32_t)me.vectors.size() - 1);
+            write_image_descriptor(vc, ss, 0, sampled, me.luma[p][l].view, VK_IMAGE_LAYOUT_GENERAL);
+            write_image_descriptor(vc, ss, 1, sampled, me.luma[p ^ 1][l].view, VK_IMAGE_LAYOUT_GENERAL);
+            write_image_descriptor(vc, ss, 2, sampled, me.vectors[coarser].view, VK_IMAGE_LAYOUT_GENERAL);
+            if (l == 0) {
+                write_image_descriptor(vc, ss, 3, storage, vc.motionVectorView, VK_IMAGE_LAYOUT_GENERAL);
+            } else {
+                write_image_descriptor(vc, ss, 3, storage, me.vectors[l].view, VK_IMAGE_LAYOUT_GENERAL);
+            }
+        }
+    }
+
+    me.current = 0;
+    me.historyValid = false;
+    me.layoutsReady = false;
+}
+
+void destroy_motion_resources(VulkanContext& vc)
+{
+    MotionEstimator& me = vc.motion;
+    for (int p = 0; p < 2; ++p) {
+        for (PyramidLevel& lvl : me.luma[p]) destroy_pyramid_level(vc, lvl);
+        me.luma[p].clear();
+    }
+    for (PyramidLevel& lvl : me.vectors) destroy_pyramid_level(vc, lvl);
+    me.vectors.clear();
+    me.levelCount = 0;
+    me.historyValid = false;
+}
+
+// Compute writes -> compute reads/writes, for the level-to-level chain
+static void compute_barrier(VkCommandBuffer cmd)
+{
+    VkMemoryBarrier mb{};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+}
+
+// Builds this frame's luma pyramid from inputColorImage (SHADER_READ_ONLY)
+// and, given the previous one, searches coarse to fine into
+// motionVectorImage. Without history the field is cleared to zero motion.
+// Leaves the vectors in SHADER_READ_ONLY for FSR / frame generation.
+void record_motion_estimation(VulkanContext& vc, VkCommandBuffer cmd, bool haveHistory)
+{
+    MotionEstimator& me = vc.motion;
+    const uint32_t stride = (uint32_t)me.params.levels;
+    haveHistory = haveHistory && me.historyValid;
+
+    if (!me.layoutsReady) {
+        for (int p = 0; p < 2; ++p) {
+            for (PyramidLevel& lvl : me.luma[p]) {
+                transition_image_layout(cmd, lvl.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+            }
+        }
+        for (PyramidLevel& lvl : me.vectors) {
+            if (!lvl.image) continue;
+            transition_image_layout(cmd, lvl.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+        me.layoutsReady = true;
+    }
+
+    // 1. Luma pyramid for this frame
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, me.downsamplePass.pipeline);
+    for (uint32_t l = 0; l < me.levelCount; ++l) {
+        const VkExtent2D dst = me.luma[me.current][l].extent;
+        const VkExtent2D src = l ? me.luma[me.current][l - 1].extent : vc.renderExtent;
+        struct { int32_t dstW, dstH, srcW, srcH, fromColor; } pc{
+            (int32_t)dst.width, (int32_t)dst.height, (int32_t)src.width, (int32_t)src.height, l == 0
+        };
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, me.downsamplePass.layout,
+                                0, 1, &me.downsamplePass.sets[me.current * stride + l], 0, nullptr);
+        vkCmdPushConstants(cmd, me.downsamplePass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+        vkCmdDispatch(cmd, (dst.width + 7) / 8, (dst.height + 7) / 8, 1);
+        compute_barrier(cmd);
+    }
+
+    if (!haveHistory) {
+        transition_image_layout(
+            cmd, vc.motionVectorImage,
+            vc.motionVectorLayout,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_ASPECT_COLOR_BIT
+        );
+
+        VkClearColorValue zero{};
+        VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkCmdClearColorImage(cmd, vc.motionVectorImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             &zero, 1, &range);
+
+        transition_image_layout(
+            cmd, vc.motionVectorImage,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_ASPECT_COLOR_BIT
+        );
+        vc.motionVectorLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    } else {
+        // 2. Coarse-to-fine search against the previous frame's pyramid
+        transition_image_layout(
+            cmd, vc.motionVectorImage,
+            vc.motionVectorLayout,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_ASPECT_COLOR_BIT
+        );
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, me.searchPass.pipeline);
+        const uint32_t block = (uint32_t)me.params.blockSize;
+        for (uint32_t l = me.levelCount; l-- > 0; ) {
+            const VkExtent2D size = me.luma[me.current][l].extent;
+            const bool coarsest = (l + 1 == me.levelCount);
+            const VkExtent2D coarse = coarsest ? size : me.luma[me.current][l + 1].extent;
+            struct { int32_t w, h, coarseW, coarseH, radius, hasPredictor, toUV; } pc{
+                (int32_t)size.width, (int32_t)size.height,
+                (int32_t)coarse.width, (int32_t)coarse.height,
+                me.params.searchRadius, !coarsest, l == 0
+            };
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, me.searchPass.layout,
+                                    0, 1, &me.searchPass.sets[me.current * stride + l], 0, nullptr);
+            vkCmdPushConstants(cmd, me.searchPass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+            vkCmdDispatch(cmd, (size.width + block - 1) / block, (size.height + block - 1) / block, 1);
+            if (l) compute_barrier(cmd);
+        }
+
+        transition_image_layout(
+            cmd, vc.motionVectorImage,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_ASPECT_COLOR_BIT
+        );
+        vc.motionVectorLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    // This frame's pyramid is the next frame's reference
+    me.current ^= 1;
+    me.historyValid = true;
+}
+
+/* ------------------------ Spatial scaler ------------------------ */
+
+// The output binding follows outputColorImage across display resizes
+void spatial_bind_output(VulkanContext& vc)
+{
+    SpatialScaler& ss = vc.spatial;
+    write_image_descriptor(vc, ss.upscalePass.sets[0], 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.outputColorView, VK_IMAGE_LAYOUT_GENERAL);
+    ss.outputValid = false;
+}
+
+// Render-sized history and the tile list. Needs inputColorView.
+void create_spatial_resources(VulkanContext& vc)
+{
+    SpatialScaler& ss = vc.spatial;
+    ss.tilesX = (vc.renderExtent.width  + SpatialScaler::kTile - 1) / SpatialScaler::kTile;
+    ss.tilesY = (vc.renderExtent.height + SpatialScaler::kTile - 1) / SpatialScaler::kTile;
+
+    // RGBA8 rather than the input's BGRA8: guaranteed as a storage format
+    create_image(vc, vc.renderExtent.width, vc.renderExtent.height, VK_FORMAT_R8G8B8A8_UNORM,
+                 VK_IMAGE_USAGE_STORAGE_BIT, ss.historyImage, ss.historyMemory,
+                 AllocStrategy::Linear);
+    ss.historyView = create_image_view(vc, ss.historyImage, VK_FORMAT_R8G8B8A8_UNORM,
+                                       VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkBufferCreateInfo bci{};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = sizeof(uint32_t) * (4 + (VkDeviceSize)ss.tilesX * ss.tilesY);
+    bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    vk_check(vkCreateBuffer(vc.device, &bci, nullptr, &ss.tileBuffer), "vkCreateBuffer tileBuffer");
+
+    ss.tileMemory = gpu_alloc_buffer(vc, ss.tileBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                     AllocStrategy::Linear);
+
+    const VkDescriptorType sampled = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    const VkDescriptorType storage = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    VkDescriptorSet ds = ss.diffPass.sets[0];
+    write_image_descriptor(vc, ds, 0, sampled, vc.inputColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    write_image_descriptor(vc, ds, 1, storage, ss.historyView, VK_IMAGE_LAYOUT_GENERAL);
+    write_buffer_descriptor(vc, ds, 2, ss.tileBuffer);
+
+    VkDescriptorSet us = ss.upscalePass.sets[0];
+    write_image_descriptor(vc, us, 0, sampled, vc.inputColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    write_buffer_descriptor(vc, us, 1, ss.tileBuffer);
+    spatial_bind_output(vc);
+}
+
+void destroy_spatial_resources(VulkanContext& vc)
+{
+    SpatialScaler& ss = vc.spatial;
+    if (ss.historyView) vkDestroyImageView(vc.device, ss.historyView, nullptr);
+    if (ss.historyImage) vkDestroyImage(vc.device, ss.historyImage, nullptr);
+    gpu_free(vc, ss.historyMemory);
+    if (ss.tileBuffer) vkDestroyBuffer(vc.device, ss.tileBuffer, nullptr);
+    gpu_free(vc, ss.tileMemory);
+    ss.historyView   = VK_NULL_HANDLE;
+    ss.historyImage  = VK_NULL_HANDLE;
+    ss.tileBuffer    = VK_NULL_HANDLE;
+    ss.outputValid   = false;
+}
+
+// inputColorImage (SHADER_READ_ONLY) -> outputColorImage (GENERAL), only
+// where the input changed. Everything is redrawn after a reset.
+void record_spatial_upscale(VulkanContext& vc, VkCommandBuffer cmd)
+{
+    SpatialScaler& ss = vc.spatial;
+    const bool force = !ss.outputValid;
+
+    if (force) {
+        transition_image_layout(cmd, ss.historyImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        transition_image_layout(cmd, vc.outputColorImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+
+    // Last frame's history/output writes, and its reads of the output
+    // (copy to swapchain, frame generation), before we touch either again
+    VkMemoryBarrier mb{};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    // Empty list, dispatch size (0, 1, 1)
+    const uint32_t header[4] = { 0, 1, 1, 0 };
+    vkCmdUpdateBuffer(cmd, ss.tileBuffer, 0, sizeof(header), header);
+
+    mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    // 1. Changed tiles
+    struct { int32_t w, h, force; } diffPc{
+        (int32_t)vc.renderExtent.width, (int32_t)vc.renderExtent.height, force
+    };
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.diffPass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.diffPass.layout,
+                            0, 1, &ss.diffPass.sets[0], 0, nullptr);
+    vkCmdPushConstants(cmd, ss.diffPass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(diffPc), &diffPc);
+    vkCmdDispatch(cmd, ss.tilesX, ss.tilesY, 1);
+
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    // 2. One workgroup per changed tile, halo included by the shader
+    const VkExtent2D activeRender = active_render_extent(vc);
+    struct { int32_t srcW, srcH, dstW, dstH; } upPc{
+        (int32_t)activeRender.width,  (int32_t)activeRender.height,
+        (int32_t)vc.displayRect.extent.width, (int32_t)vc.displayRect.extent.height
+    };
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.upscalePass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.upscalePass.layout,
+                            0, 1, &ss.upscalePass.sets[0], 0, nullptr);
+    vkCmdPushConstants(cmd, ss.upscalePass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(upPc), &upPc);
+    vkCmdDispatchIndirect(cmd, ss.tileBuffer, 0);
+
+    // Output -> copy to swapchain / frame generation
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    ss.outputValid = true;
+}
+
+// Whether this frame can skip every intermediate image: frame generation
+// needs outputColorImage and the motion field, so it keeps the long path
+// FSR can upscale straight into the swapchain image when nothing else
+// needs outputColorImage this frame: no frame generation (history and the
+// follow-up presents read it), no foveated composite, and no letterbox bars
+// (FSR writes at the image origin, the bars need a clear)
+static bool swap_direct_usable(const VulkanContext& vc, const FSRContext& fc)
+{
+    return vc.swapStorage && !vc.swapViews.empty() && !vc.spatial.enabled &&
+           !vc.foveation.active && !display_cropped(vc) &&
+           !(fc.frameGen.enabled && fc.frameGen.activeMultiplier > 1);
+}
+
+static bool spatial_fused_usable(const VulkanContext& vc, const FSRContext& fc)
+{
+    return vc.spatial.fused && vc.swapStorage && !vc.swapViews.empty() &&
+           !(fc.frameGen.enabled && fc.frameGen.activeMultiplier > 1);
+}
+
+// Staging buffer -> swapchain image (ending in PRESENT_SRC), one read of
+// the capture and one write of the output
+void record_spatial_fused(VulkanContext& vc, VkCommandBuffer cmd, uint32_t imageIndex)
+{
+    SpatialScaler& ss = vc.spatial;
+
+    // The set isn't in use: the frame fence was waited on before recording
+    VkDescriptorSet set = ss.fusedPass.sets[0];
+    write_buffer_descriptor(vc, set, 0, vc.stagingBuffer);
+    write_image_descriptor(vc, set, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.swapViews[imageIndex], VK_IMAGE_LAYOUT_GENERAL);
+
+    VkImage swapImg = vc.swapImages[imageIndex];
+    acquire_swap_image(cmd, swapImg, VK_IMAGE_LAYOUT_GENERAL);
+
+    struct {
+        int32_t srcW, srcH, srcStride;
+        float sharpness;
+        int32_t rx, ry, rw, rh;
+        int32_t dstW, dstH;
+    } pc{
+        (int32_t)vc.activeRect.extent.width, (int32_t)vc.activeRect.extent.height,
+        (int32_t)vc.captureExtent.width, ss.sharpness,
+        vc.displayRect.offset.x, vc.displayRect.offset.y,
+        (int32_t)vc.displayRect.extent.width, (int32_t)vc.displayRect.extent.height,
+        (int32_t)vc.swapExtent.width, (int32_t)vc.swapExtent.height
+    };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.fusedPass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ss.fusedPass.layout,
+                            0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(cmd, ss.fusedPass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdDispatch(cmd, (vc.swapExtent.width + 7) / 8, (vc.swapExtent.height + 7) / 8, 1);
+
+    transition_image_layout(cmd, swapImg, VK_IMAGE_LAYOUT_GENERAL,
+                            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // Nothing downstream saw this frame: the long path starts from scratch
+    ss.outputValid = false;
+    vc.motion.historyValid = false;
+}
+
+/* -------------------------- Foveation --------------------------- */
+
+// Images for the largest ROI; the output is display-sized, so this is
+// rebuilt with the output image. Needs inputColorView.
+void create_foveation_resources(VulkanContext& vc)
+{
+    Foveation& fv = vc.foveation;
+    fv.renderCapacity  = { std::max(2u, (uint32_t)std::ceil(vc.renderExtent.width  * fv.size)),
+                           std::max(2u, (uint32_t)std::ceil(vc.renderExtent.height * fv.size)) };
+    fv.displayCapacity = { std::max(2u, (uint32_t)std::ceil(vc.displayExtent.width  * fv.size) + 2),
+                           std::max(2u, (uint32_t)std::ceil(vc.displayExtent.height * fv.size) + 2) };
+
+    create_image(vc, fv.renderCapacity.width, fv.renderCapacity.height, VK_FORMAT_B8G8R8A8_UNORM,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 fv.colorImage, fv.colorMemory);
+    fv.colorView = create_image_view(vc, fv.colorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    create_image(vc, fv.renderCapacity.width, fv.renderCapacity.height, VK_FORMAT_R16G16_SFLOAT,
+                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 fv.motionImage, fv.motionMemory);
+    fv.motionView = create_image_view(vc, fv.motionImage, VK_FORMAT_R16G16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    create_image(vc, fv.displayCapacity.width, fv.displayCapacity.height, VK_FORMAT_B8G8R8A8_UNORM,
+                 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                 fv.outputImage, fv.outputMemory);
+    fv.outputView = create_image_view(vc, fv.outputImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkDescriptorSet set = fv.compositePass.sets[0];
+    write_image_descriptor(vc, set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.inputColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, vc.linearSampler);
+    write_image_descriptor(vc, set, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           fv.outputView, VK_IMAGE_LAYOUT_GENERAL);
+    write_image_descriptor(vc, set, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.outputColorView, VK_IMAGE_LAYOUT_GENERAL);
+
+    fv.renderRoi = {};
+    fv.displayRoi = {};
+    fv.active = false;
+}
+
+void destroy_foveation_resources(VulkanContext& vc)
+{
+    Foveation& fv = vc.foveation;
+    auto destroy = [&](VkImageView& view, VkImage& image, GpuAllocation& memory) {
+        if (view) vkDestroyImageView(vc.device, view, nullptr);
+        if (image) vkDestroyImage(vc.device, image, nullptr);
+        gpu_free(vc, memory);
+        view = VK_NULL_HANDLE;
+        image = VK_NULL_HANDLE;
+    };
+    destroy(fv.colorView, fv.colorImage, fv.colorMemory);
+    destroy(fv.motionView, fv.motionImage, fv.motionMemory);
+    destroy(fv.outputView, fv.outputImage, fv.outputMemory);
+    fv.active = false;
+}
+
+// Places the ROI for this frame: centred, or around the pointer. The ROI
+// only re-centres once the pointer nears its edge, since every move drops
+// FSR's history (the ROI's content jumps within FSR's input).
+void update_foveation_roi(VulkanContext& vc, FSRContext& fc, const X11Context& xc)
+{
+    Foveation& fv = vc.foveation;
+    if (!fv.colorImage) return;
+
+    const VkExtent2D ar = active_render_extent(vc);
+    const uint32_t rw = std::min((uint32_t)(ar.width  * fv.size) & ~1u, fv.renderCapacity.width);
+    const uint32_t rh = std::min((uint32_t)(ar.height * fv.size) & ~1u, fv.renderCapacity.height);
+
+    // Nothing to save on a picture this small, or a ROI this large
+    if (rw < 64 || rh < 64 || (uint64_t)rw * rh * 10 >= (uint64_t)ar.width * ar.height * 9) {
+        fv.active = false;
+        return;
+    }
 
-    // STEP 1: Copy captured data from staging buffer to inputColorImage
-    VkImageLayout capOld = (frameCount == 0)
-        ? VK_IMAGE_LAYOUT_UNDEFINED
-        : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    int32_t cx = (int32_t)ar.width / 2;
+    int32_t cy = (int32_t)ar.height / 2;
+    bool keep = false;
+    if (fv.mode == Foveation::Mode::Pointer) {
+        Window rootRet, childRet;
+        int rootX, rootY, winX, winY;
+        unsigned int mask;
+        if (XQueryPointer(xc.dpy, xc.targetWindow, &rootRet, &childRet,
+                          &rootX, &rootY, &winX, &winY, &mask)) {
+            // Window -> active capture area -> render space
+            const VkRect2D& a = vc.activeRect;
+            cx = (int32_t)((int64_t)(winX - a.offset.x) * ar.width  / std::max(1u, a.extent.width));
+            cy = (int32_t)((int64_t)(winY - a.offset.y) * ar.height / std::max(1u, a.extent.height));
+        }
+
+        // Inside the middle half of the current ROI: leave it where it is
+        const VkRect2D& r = fv.renderRoi;
+        keep = r.extent.width == rw && r.extent.height == rh &&
+               cx >= r.offset.x + (int32_t)rw / 4 && cx < r.offset.x + (int32_t)(rw * 3) / 4 &&
+               cy >= r.offset.y + (int32_t)rh / 4 && cy < r.offset.y + (int32_t)(rh * 3) / 4;
+    }
+
+    if (!keep) {
+        VkRect2D roi{};
+        roi.offset.x = std::clamp(cx - (int32_t)rw / 2, 0, (int32_t)(ar.width  - rw)) & ~1;
+        roi.offset.y = std::clamp(cy - (int32_t)rh / 2, 0, (int32_t)(ar.height - rh)) & ~1;
+        roi.extent = { rw, rh };
+        if (!rect_equal(roi, fv.renderRoi)) {
+            fv.renderRoi = roi;
+            fc.resetHistory = true;
+        }
+    }
+
+    // Same place on the display; FSR's output goes to displayRoi
+    const VkExtent2D dr = vc.displayRect.extent;
+    const VkRect2D& r = fv.renderRoi;
+    int32_t x0 = (int32_t)((uint64_t)r.offset.x * dr.width  / ar.width);
+    int32_t y0 = (int32_t)((uint64_t)r.offset.y * dr.height / ar.height);
+    int32_t x1 = (int32_t)((uint64_t)(r.offset.x + r.extent.width)  * dr.width  / ar.width);
+    int32_t y1 = (int32_t)((uint64_t)(r.offset.y + r.extent.height) * dr.height / ar.height);
+    fv.displayRoi = { { x0, y0 }, { std::min((uint32_t)(x1 - x0), fv.displayCapacity.width),
+                                    std::min((uint32_t)(y1 - y0), fv.displayCapacity.height) } };
+    fv.active = true;
+}
 
+// ROI of inputColorImage and motionVectorImage (both SHADER_READ_ONLY,
+// and left that way) to the origin of the ROI images
+void record_foveation_inputs(VulkanContext& vc, VkCommandBuffer cmd)
+{
+    Foveation& fv = vc.foveation;
+
+    VkImageCopy copy{};
+    copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.srcOffset = { fv.renderRoi.offset.x, fv.renderRoi.offset.y, 0 };
+    copy.dstOffset = { 0, 0, 0 };
+    copy.extent = { fv.renderRoi.extent.width, fv.renderRoi.extent.height, 1 };
+
+    const VkImage src[2] = { vc.inputColorImage, vc.motionVectorImage };
+    const VkImage dst[2] = { fv.colorImage, fv.motionImage };
+    BarrierBatch batch;
+    for (int i = 0; i < 2; ++i) {
+        barrier_add(cmd, batch, src[i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier_add(cmd, batch, dst[i], VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+    barrier_flush(cmd, batch);
+
+    for (int i = 0; i < 2; ++i) {
+        vkCmdCopyImage(cmd, src[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       dst[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        barrier_add(cmd, batch, dst[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier_add(cmd, batch, src[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+    // FSR writes the ROI output
+    barrier_add(cmd, batch, fv.outputImage, VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT);
+    barrier_flush(cmd, batch);
+}
+
+// ROI output over the bilinear periphery into outputColorImage (GENERAL)
+void record_foveation_composite(VulkanContext& vc, VkCommandBuffer cmd)
+{
+    Foveation& fv = vc.foveation;
+    compute_barrier(cmd);
+
+    const VkExtent2D ar = active_render_extent(vc);
+    struct {
+        int32_t w, h;
+        float sx, sy;
+        int32_t rx, ry, rw, rh;
+        int32_t feather;
+    } pc{
+        (int32_t)vc.displayRect.extent.width, (int32_t)vc.displayRect.extent.height,
+        (float)ar.width / (float)vc.renderExtent.width, (float)ar.height / (float)vc.renderExtent.height,
+        fv.displayRoi.offset.x, fv.displayRoi.offset.y,
+        (int32_t)fv.displayRoi.extent.width, (int32_t)fv.displayRoi.extent.height,
+        fv.feather
+    };
+
+    const ComputePass& pass = fv.compositePass;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass.layout,
+                            0, 1, &pass.sets[0], 0, nullptr);
+    vkCmdPushConstants(cmd, pass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdDispatch(cmd, (pc.w + 7) / 8, (pc.h + 7) / 8, 1);
+
+    // Output -> copy to swapchain / frame generation
+    VkMemoryBarrier mb{};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+}
+
+GpuStageStats gpu_profile_stats(const GpuProfiler& gp, GpuStage stage);
+
+// After the fence, once per foveated frame: now and then reports the ROI
+// cost (the profiler's Upscale and Composite stages) against the full-frame
+// FSR cost it stands in for. FSR scales with output pixels, so the full
+// frame is estimated from the ROI share of the display rather than measured.
+void foveation_report(VulkanContext& vc)
+{
+    Foveation& fv = vc.foveation;
+    if (!fv.active) return;
+    fv.roiFraction += (double)fv.displayRoi.extent.width * fv.displayRoi.extent.height /
+                      std::max(1.0, (double)vc.displayRect.extent.width * vc.displayRect.extent.height);
+
+    if (++fv.samples < 300) return;
+    const double fsr = gpu_profile_stats(vc.profiler, GpuStage::Upscale).avgMs;
+    const double composite = gpu_profile_stats(vc.profiler, GpuStage::Composite).avgMs;
+    const double fraction = fv.roiFraction / fv.samples;
+    const double full = fraction > 0.0 ? fsr / fraction : fsr;
+    std::printf("Foveation: %.2f ms (FSR %.2f + composite %.2f) on %.0f%% of the pixels, "
+                "full frame ~%.2f ms, %.0f%% saved\n",
+                fsr + composite, fsr, composite, fraction * 100.0, full,
+                full > 0.0 ? 100.0 * (1.0 - (fsr + composite) / full) : 0.0);
+    fv.roiFraction = 0.0;
+    fv.samples = 0;
+}
+
+/* ----------------------- Frame generation ----------------------- */
+
+void destroy_framegen(VulkanContext& vc, FSRContext& fc)
+{
+    FrameGenState& fg = fc.frameGen;
+    if (fg.context) {
+        ffx::DestroyContext(fg.context);
+        fg.context = nullptr;
+    }
+    fg.displaySize   = {0,0};
+    fg.maxRenderSize = {0,0};
+    fg.outputHistoryValid = false;
+
+    if (vc.interpolatedColorView) vkDestroyImageView(vc.device, vc.interpolatedColorView, nullptr);
+    if (vc.interpolatedColorImage) vkDestroyImage(vc.device, vc.interpolatedColorImage, nullptr);
+    gpu_free(vc, vc.interpolatedColorMemory);
+    vc.interpolatedColorView   = VK_NULL_HANDLE;
+    vc.interpolatedColorImage  = VK_NULL_HANDLE;
+
+    if (vc.prevOutputColorView) vkDestroyImageView(vc.device, vc.prevOutputColorView, nullptr);
+    if (vc.prevOutputColorImage) vkDestroyImage(vc.device, vc.prevOutputColorImage, nullptr);
+    gpu_free(vc, vc.prevOutputColorMemory);
+    vc.prevOutputColorView   = VK_NULL_HANDLE;
+    vc.prevOutputColorImage  = VK_NULL_HANDLE;
+    vc.prevOutputColorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+static void create_framegen_ffx_context(VulkanContext& vc, FSRContext& fc)
+{
+    FrameGenState& fg = fc.frameGen;
+
+    ffx::CreateBackendVKDesc backendDesc{};
+    backendDesc.header.type      = FFX_API_CREATE_CONTEXT_DESC_TYPE_BACKEND_VK;
+    backendDesc.vkDevice         = vc.device;
+    backendDesc.vkPhysicalDevice = vc.physDevice;
+    backendDesc.vkDeviceProcAddr = ffx_get_device_proc_addr;
+
+    ffx::CreateContextDescFrameGeneration createFg{};
+    createFg.header.type      = FFX_API_CREATE_CONTEXT_DESC_TYPE_FRAMEGENERATION;
+    createFg.displaySize      = { vc.displayExtent.width, vc.displayExtent.height };
+    createFg.maxRenderSize    = { vc.renderExtent.width,  vc.renderExtent.height  };
+    createFg.backBufferFormat = FFX_API_SURFACE_FORMAT_B8G8R8A8_UNORM;
+#ifndef NDEBUG
+    createFg.flags            = FFX_FRAMEGENERATION_ENABLE_DEBUG_CHECKING;
+#else
+    createFg.flags            = 0;
+#endif
+
+    auto t0 = std::chrono::steady_clock::now();
+    ffx::ReturnCode rc = ffx::CreateContext(fg.context, nullptr, createFg, backendDesc);
+    if (!rc || !fg.context) {
+        fprintf(stderr, "CreateContext(FRAMEGENERATION) failed: %d, using own interpolation\n", (int)rc);
+        fg.context = nullptr;
+        return;
+    }
+    std::printf("Frame generation context created in %.1f ms\n",
+                std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count());
+
+    // No FFX swapchain and no callback: dispatches come from us, and the
+    // generated frame is written to outputs[0] for us to present.
+    ffx::ConfigureDescFrameGeneration cfg{};
+    cfg.header.type               = FFX_API_CONFIGURE_DESC_TYPE_FRAMEGENERATION;
+    cfg.swapChain                 = nullptr;
+    cfg.presentCallback           = nullptr;
+    cfg.frameGenerationCallback   = nullptr;
+    cfg.frameGenerationEnabled    = true;
+    cfg.allowAsyncWorkloads       = false;
+    cfg.HUDLessColor              = {};
+    cfg.flags                     = 0;
+    cfg.onlyPresentGenerated      = false;
+    cfg.generationRect            = { 0, 0, (int32_t)vc.displayExtent.width, (int32_t)vc.displayExtent.height };
+    cfg.frameID                   = fg.frameID;
+
+    rc = ffx::Configure(fg.context, cfg);
+    if (!rc) {
+        fprintf(stderr, "ffx::Configure(FRAMEGENERATION) failed: %d, using own interpolation\n", (int)rc);
+        ffx::DestroyContext(fg.context);
+        fg.context = nullptr;
+    }
+}
+
+// Creates (or keeps) frame generation state for the current extents: the
+// FFX context (2x), our interpolation targets (any multiplier) and the
+// timing queries. Caller guarantees the GPU is idle for us (fence waited).
+bool init_framegen(VulkanContext& vc, FSRContext& fc)
+{
+    FrameGenState& fg = fc.frameGen;
+
+    const bool fits =
+        vc.interpolatedColorImage &&
+        fg.displaySize.width   == vc.displayExtent.width &&
+        fg.displaySize.height  == vc.displayExtent.height &&
+        fg.maxRenderSize.width  >= vc.renderExtent.width &&
+        fg.maxRenderSize.height >= vc.renderExtent.height;
+
+    if (!fits) {
+        destroy_framegen(vc, fc);
+
+        const VkImageUsageFlags usage =
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        create_image(vc, vc.displayExtent.width, vc.displayExtent.height, VK_FORMAT_B8G8R8A8_UNORM,
+                     usage, vc.interpolatedColorImage, vc.interpolatedColorMemory);
+        vc.interpolatedColorView = create_image_view(
+            vc, vc.interpolatedColorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        create_image(vc, vc.displayExtent.width, vc.displayExtent.height, VK_FORMAT_B8G8R8A8_UNORM,
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                     vc.prevOutputColorImage, vc.prevOutputColorMemory);
+        vc.prevOutputColorView = create_image_view(
+            vc, vc.prevOutputColorImage, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+        vc.prevOutputColorLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        fg.displaySize   = { vc.displayExtent.width, vc.displayExtent.height };
+        fg.maxRenderSize = { vc.renderExtent.width,  vc.renderExtent.height  };
+        fg.resetHistory  = true;
+        fg.outputHistoryValid = false;
+
+        // FFX frame generation pairs with the FSR upscaler; the spatial
+        // scaler leaves 2x to our interpolate kernel too
+        if (!vc.spatial.enabled) create_framegen_ffx_context(vc, fc);
+    }
+
+    if (!fg.ownKernels) return true;   // FFX only, no sets to write
+
+    // Cheap, and the motion vector view changes per session
+    VkDescriptorSet set = vc.interpolatePass.sets[0];
+    write_image_descriptor(vc, set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.prevOutputColorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, vc.linearSampler);
+    write_image_descriptor(vc, set, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.outputColorView, VK_IMAGE_LAYOUT_GENERAL, vc.linearSampler);
+    write_image_descriptor(vc, set, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.motionVectorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, vc.linearSampler);
+    write_image_descriptor(vc, set, 3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.interpolatedColorView, VK_IMAGE_LAYOUT_GENERAL);
+
+    set = vc.extrapolatePass.sets[0];
+    write_image_descriptor(vc, set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.outputColorView, VK_IMAGE_LAYOUT_GENERAL, vc.linearSampler);
+    write_image_descriptor(vc, set, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                           vc.motionVectorView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    write_image_descriptor(vc, set, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.interpolatedColorView, VK_IMAGE_LAYOUT_GENERAL);
+    return true;
+}
+
+// FFX covers exactly one interpolated frame; everything else is ours
+static bool framegen_uses_ffx(const FrameGenState& fg)
+{
+    return fg.context && fg.activeMultiplier == 2 && !fg.extrapolate;
+}
+
+// Keeps the real frame about to be overwritten by FSR as t = 0 for the
+// interpolate kernel. outputColorImage stays in GENERAL; whoever transitions
+// it next has to wait for the copy (TRANSFER source stage, see STEP 2 in
+// record_upscale_and_present).
+void save_output_history(VulkanContext& vc, VkCommandBuffer cmd)
+{
     transition_image_layout(
-        cmd, vc.captureColorImage,
-        capOld,
+        cmd, vc.prevOutputColorImage,
+        vc.prevOutputColorLayout,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    // IMPORTANT: your staging rows are packed as swapExtent.width * 4 bytes per row
-    // (see upload_capture_to_staging: dstStride = vc.swapExtent.width * 4) :contentReference[oaicite:6]{index=6}
-    VkBufferImageCopy capCopy{};
-    capCopy.bufferOffset = 0;
-    capCopy.bufferRowLength   = vc.captureExtent.width;
-    capCopy.bufferImageHeight = vc.captureExtent.height;
-    capCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    capCopy.imageSubresource.mipLevel = 0;
-    capCopy.imageSubresource.baseArrayLayer = 0;
-    capCopy.imageSubresource.layerCount = 1;
-    capCopy.imageOffset = {0, 0, 0};
-    capCopy.imageExtent = { vc.captureExtent.width, vc.captureExtent.height, 1 };
-
-    vkCmdCopyBufferToImage(
+    VkImageCopy copy{};
+    copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.extent = { vc.displayExtent.width, vc.displayExtent.height, 1 };
+    vkCmdCopyImage(
         cmd,
-        vc.stagingBuffer,
-        vc.captureColorImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &capCopy
+        vc.outputColorImage,     VK_IMAGE_LAYOUT_GENERAL,
+        vc.prevOutputColorImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &copy
     );
 
+    // Only readies the history for sampling: its execution dependency orders
+    // later compute work after the copy, not the layout transition that
+    // discards outputColorImage before FSR writes it
     transition_image_layout(
-        cmd, vc.captureColorImage,
+        cmd, vc.prevOutputColorImage,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
+    vc.prevOutputColorLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
 
-    // --- Prepare low-res inputColorImage as blit destination ---
-    VkImageLayout inOld = (frameCount == 0)
-        ? VK_IMAGE_LAYOUT_UNDEFINED
-        : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
+// Generated frame into interpolatedColorImage (GENERAL). t is in source
+// intervals with the previous real frame at 0 and the current one at 1:
+// t < 1 interpolates from prevOutputColorImage, t > 1 extrapolates.
+void record_interpolate(VulkanContext& vc, VkCommandBuffer cmd, float t)
+{
     transition_image_layout(
-        cmd, vc.inputColorImage,
-        inOld,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        cmd, vc.interpolatedColorImage,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_GENERAL,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    // --- Blit (scale) full-res capture -> low-res input ---
-    VkImageBlit blit{};
-    blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-    blit.srcOffsets[0]  = { 0, 0, 0 };
-    blit.srcOffsets[1] =  { (int)vc.captureExtent.width, (int)vc.captureExtent.height, 1 };
+    const bool extrapolate = t > 1.0f;
+    const ComputePass& pass = extrapolate ? vc.extrapolatePass : vc.interpolatePass;
+    struct { int32_t w, h; float t; } pc{
+        (int32_t)vc.displayExtent.width, (int32_t)vc.displayExtent.height, extrapolate ? t - 1.0f : t
+    };
 
-    blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-    blit.dstOffsets[0]  = { 0, 0, 0 };
-    blit.dstOffsets[1]  = { (int)vc.renderExtent.width, (int)vc.renderExtent.height, 1 };
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pass.layout,
+                            0, 1, &pass.sets[0], 0, nullptr);
+    vkCmdPushConstants(cmd, pass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdDispatch(cmd, (vc.displayExtent.width + 7) / 8, (vc.displayExtent.height + 7) / 8, 1);
+
+    // Storage write -> transfer read by record_copy_to_swap()
+    VkMemoryBarrier mb{};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+}
 
-    vkCmdBlitImage(
-        cmd,
-        vc.captureColorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        vc.inputColorImage,   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &blit,
-        VK_FILTER_NEAREST
-    );
+// Adaptive mode: as many frames as the panel can show per source frame, then
+// fewer while the GPU work for one source frame doesn't fit its interval.
+void update_frame_multiplier(FSRContext& fc, const GpuProfiler& gp)
+{
+    FrameGenState& fg = fc.frameGen;
+    if (!fg.adaptive) {
+        fg.activeMultiplier = fg.multiplier;
+        return;
+    }
 
-    // --- Input is now ready for FSR sampling ---
-    transition_image_layout(
-        cmd, vc.inputColorImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        VK_IMAGE_ASPECT_COLOR_BIT
+    // Re-decide about twice a second of source frames to avoid flapping
+    if (++fg.framesSinceAdapt < 30) return;
+    fg.framesSinceAdapt = 0;
+
+    const float budgetMs = fg.sourceInterval * 1000.0f * 0.9f;
+    int n = (int)std::lround(fg.refreshHz * fg.sourceInterval);
+    n = std::clamp(n, 1, fg.ownKernels ? 4 : 2);
+    // Interpolation: timer 0 already covers the first generated frame and
+    // the last followup is a plain copy, n - 2 more. Extrapolation: timer 0
+    // is the real frame only and all n - 1 followups run the warp kernel.
+    while (n > 1 &&
+           gp.frameMs + (float)(fg.extrapolate ? n - 1 : n - 2) * gp.generatedMs > budgetMs) {
+        --n;
+    }
+
+    if (n != fg.activeMultiplier) {
+        std::printf("Frame generation: %dx (source %.1f fps, %.0f Hz, frame %.2f ms, generated %.2f ms)\n",
+                    n, 1.0f / fg.sourceInterval, fg.refreshHz, gp.frameMs, gp.generatedMs);
+        fg.activeMultiplier = n;
+        fg.resetHistory = true;
+    }
+}
+
+// Records FG prepare + dispatch after the upscale. The upscaled frame in
+// outputColorImage is the newest real frame; FFX keeps the previous one and
+// writes the midpoint into interpolatedColorImage. Returns false when there
+// is nothing to interpolate yet (first frame after a reset).
+bool dispatch_framegen(VulkanContext& vc, FSRContext& fc, VkCommandBuffer cmd,
+                       float jitterX, float jitterY, float deltaTime)
+{
+    FrameGenState& fg = fc.frameGen;
+    if (!fg.context) return false;
+
+    const uint64_t frameID = ++fg.frameID;
+
+    ffx::DispatchDescFrameGenerationPrepare prepare{};
+    prepare.header.type             = FFX_API_DISPATCH_DESC_TYPE_FRAMEGENERATION_PREPARE;
+    prepare.frameID                 = frameID;
+    prepare.flags                   = 0;
+    prepare.commandList             = cmd;
+    const VkExtent2D activeRender = active_render_extent(vc);
+    prepare.renderSize              = { activeRender.width, activeRender.height };
+    prepare.jitterOffset            = { -jitterX, -jitterY };
+    prepare.motionVectorScale       = { (float)vc.renderExtent.width, (float)vc.renderExtent.height };
+    prepare.frameTimeDelta          = deltaTime * 1000.0f;
+    prepare.cameraNear              = 0.1f;
+    prepare.cameraFar               = 1000.0f;
+    prepare.cameraFovAngleVertical  = 1.0f;
+    prepare.viewSpaceToMetersFactor = 1.0f;
+    prepare.depth = make_ffx_api_resource_vk(
+        vc.depthImage, vc.depthView, VK_FORMAT_D32_SFLOAT,
+        vc.renderExtent.width, vc.renderExtent.height,
+        FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
+        "LS_Depth"
+    );
+    prepare.motionVectors = make_ffx_api_resource_vk(
+        vc.motionVectorImage, vc.motionVectorView, VK_FORMAT_R16G16_SFLOAT,
+        vc.renderExtent.width, vc.renderExtent.height,
+        FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ,
+        "LS_MotionVectors"
     );
 
-    // STEP 2: Prepare output image for FSR
+    ffx::ReturnCode rc = ffx::Dispatch(fg.context, prepare);
+    if (!rc) {
+        fprintf(stderr, "ffx::Dispatch(FRAMEGENERATION_PREPARE) failed: %d\n", (int)rc);
+        return false;
+    }
+
     transition_image_layout(
-        cmd, vc.outputColorImage,
+        cmd, vc.interpolatedColorImage,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
 
-    // STEP 3: Run FSR upscaling
-    // Simple halton sequence for jitter (improves temporal quality)
-    float jitterX = 0.0f, jitterY = 0.0f;
-    if (frameCount % 2 == 0) {
-        jitterX = 0.5f / vc.renderExtent.width;
-        jitterY = 0.5f / vc.renderExtent.height;
+    ffx::DispatchDescFrameGeneration dispatch{};
+    dispatch.header.type  = FFX_API_DISPATCH_DESC_TYPE_FRAMEGENERATION;
+    dispatch.commandList  = cmd;
+    dispatch.presentColor = make_ffx_api_resource_vk(
+        vc.outputColorImage, vc.outputColorView, VK_FORMAT_B8G8R8A8_UNORM,
+        vc.displayExtent.width, vc.displayExtent.height,
+        FFX_API_RESOURCE_STATE_UNORDERED_ACCESS,
+        "LS_PresentColor"
+    );
+    dispatch.outputs[0] = make_ffx_api_resource_vk(
+        vc.interpolatedColorImage, vc.interpolatedColorView, VK_FORMAT_B8G8R8A8_UNORM,
+        vc.displayExtent.width, vc.displayExtent.height,
+        FFX_API_RESOURCE_STATE_UNORDERED_ACCESS,
+        "LS_InterpolatedColor",
+        FFX_API_RESOURCE_USAGE_UAV
+    );
+    dispatch.numGeneratedFrames         = 1;
+    dispatch.reset                      = fg.resetHistory;
+    dispatch.backbufferTransferFunction = FFX_API_BACKBUFFER_TRANSFER_FUNCTION_SRGB;
+    dispatch.minMaxLuminance[0]         = 0.0f;
+    dispatch.minMaxLuminance[1]         = 1.0f;
+    dispatch.generationRect             = { 0, 0, (int32_t)vc.displayRect.extent.width, (int32_t)vc.displayRect.extent.height };
+    dispatch.frameID                    = frameID;
+
+    rc = ffx::Dispatch(fg.context, dispatch);
+    if (!rc) {
+        fprintf(stderr, "ffx::Dispatch(FRAMEGENERATION) failed: %d\n", (int)rc);
+        return false;
     }
-    
-    dispatch_fsr(vc, fc, cmd, jitterX, jitterY, deltaTime); 
 
-    // STEP 4: Copy upscaled result to swapchain
+    // A reset dispatch only seeds history, its output isn't worth showing
+    bool generated = !fg.resetHistory;
+    fg.resetHistory = false;
+    return generated;
+}
+
+/* ------------------------- GPU profiler ------------------------- */
+
+void gpu_profiler_init(VulkanContext& vc)
+{
+    GpuProfiler& gp = vc.profiler;
+    if (const char* log = std::getenv("LSFL_GPU_PROFILE")) {
+        gp.log = std::strcmp(log, "0") != 0;
+    }
+
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(vc.physDevice, &props);
+    if (!props.limits.timestampComputeAndGraphics || props.limits.timestampPeriod <= 0.0f) {
+        std::fprintf(stderr, "No timestamps on the graphics queue, GPU profiler off\n");
+        return;
+    }
+    gp.timestampPeriod = props.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vc.physDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(vc.physDevice, &familyCount, families.data());
+    const uint32_t validBits = families[vc.queueFamilyIndex].timestampValidBits;
+    if (validBits == 0) {
+        std::fprintf(stderr, "No timestamps on the graphics queue, GPU profiler off\n");
+        return;
+    }
+    gp.tickMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo qpci{};
+    qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    qpci.queryCount = GpuProfiler::kSlots * GpuProfiler::kMarks;
+    vk_check(vkCreateQueryPool(vc.device, &qpci, nullptr, &gp.pool), "vkCreateQueryPool");
+}
+
+void gpu_profiler_destroy(VulkanContext& vc)
+{
+    GpuProfiler& gp = vc.profiler;
+    if (gp.pool) vkDestroyQueryPool(vc.device, gp.pool, nullptr);
+    gp.pool = VK_NULL_HANDLE;
+}
+
+// Takes the next slot for the command buffer being recorded. A slot still
+// unread from kSlots submissions ago is dropped. followup: a later
+// submission of a generated group (record_present_followup).
+void gpu_profile_begin(VulkanContext& vc, VkCommandBuffer cmd, bool followup = false)
+{
+    GpuProfiler& gp = vc.profiler;
+    if (!gp.pool) return;
+
+    const uint32_t s = gp.next;
+    gp.next = (gp.next + 1) % GpuProfiler::kSlots;
+    GpuProfiler::Slot& slot = gp.slots[s];
+    slot.marks = 1;
+    slot.pending = true;
+    slot.followup = followup;
+    vkCmdResetQueryPool(cmd, gp.pool, s * GpuProfiler::kMarks, GpuProfiler::kMarks);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, gp.pool, s * GpuProfiler::kMarks);
+    gp.recording = (int32_t)s;
+}
+
+// `stage` ends here; a stage marked twice in one submission is summed
+void gpu_profile_mark(VulkanContext& vc, VkCommandBuffer cmd, GpuStage stage)
+{
+    GpuProfiler& gp = vc.profiler;
+    if (gp.recording < 0) return;
+
+    GpuProfiler::Slot& slot = gp.slots[gp.recording];
+    if (slot.marks == GpuProfiler::kMarks) return;
+    slot.stage[slot.marks] = stage;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, gp.pool,
+                        (uint32_t)gp.recording * GpuProfiler::kMarks + slot.marks);
+    ++slot.marks;
+}
+
+void gpu_profile_end(VulkanContext& vc)
+{
+    vc.profiler.recording = -1;
+}
+
+static void gpu_profile_push(GpuProfiler& gp, uint32_t stage, float ms)
+{
+    gp.window[stage][gp.head[stage]] = ms;
+    gp.head[stage] = (gp.head[stage] + 1) % GpuProfiler::kWindow;
+    gp.count[stage] = std::min(gp.count[stage] + 1, GpuProfiler::kWindow);
+}
+
+// Rolling stats over the last kWindow samples, for the log and anything else
+// that wants to show them
+GpuStageStats gpu_profile_stats(const GpuProfiler& gp, GpuStage stage)
+{
+    const uint32_t i = (uint32_t)stage;
+    const uint32_t n = gp.count[i];
+    GpuStageStats st{};
+    st.samples = n;
+    if (!n) return st;
+
+    float sorted[GpuProfiler::kWindow];
+    std::copy(gp.window[i], gp.window[i] + n, sorted);
+    std::sort(sorted, sorted + n);
+    st.minMs = sorted[0];
+    st.avgMs = std::accumulate(sorted, sorted + n, 0.0f) / (float)n;
+    st.p99Ms = sorted[(n * 99 + 99) / 100 - 1];
+    return st;
+}
+
+static void gpu_profile_report(const GpuProfiler& gp)
+{
+    std::string line = "GPU ms min/avg/p99:";
+    for (uint32_t i = 0; i < GpuProfiler::kStages; ++i) {
+        GpuStageStats st = gpu_profile_stats(gp, (GpuStage)i);
+        if (!st.samples) continue;
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), " %s %.2f/%.2f/%.2f",
+                      kGpuStageNames[i], st.minMs, st.avgMs, st.p99Ms);
+        line += buf;
+    }
+    std::printf("%s\n", line.c_str());
+}
+
+// After a fence wait. Never waits on the queries: a slot whose results
+// aren't all there yet stays pending for the next call.
+void gpu_profile_collect(VulkanContext& vc)
+{
+    GpuProfiler& gp = vc.profiler;
+    if (!gp.pool) return;
+
+    for (uint32_t s = 0; s < GpuProfiler::kSlots; ++s) {
+        GpuProfiler::Slot& slot = gp.slots[s];
+        if (!slot.pending || (int32_t)s == gp.recording) continue;
+
+        uint64_t ticks[GpuProfiler::kMarks] = {};
+        if (vkGetQueryPoolResults(vc.device, gp.pool, s * GpuProfiler::kMarks, slot.marks,
+                                  sizeof(ticks), ticks, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+            continue;
+        }
+        slot.pending = false;
+
+        // Differences modulo the valid bits, so a counter wrap is harmless
+        auto toMs = [&](uint64_t from, uint64_t to) {
+            return (float)((to - from) & gp.tickMask) * gp.timestampPeriod * 1e-6f;
+        };
+        float ms[GpuProfiler::kStages] = {};
+        bool seen[GpuProfiler::kStages] = {};
+        for (uint32_t m = 1; m < slot.marks; ++m) {
+            const uint32_t i = (uint32_t)slot.stage[m];
+            ms[i] += toMs(ticks[m - 1], ticks[m]);
+            seen[i] = true;
+        }
+        if (slot.marks > 1) {
+            const uint32_t total = (uint32_t)GpuStage::Submission;
+            ms[total] = toMs(ticks[0], ticks[slot.marks - 1]);
+            seen[total] = true;
+            histogram_record(vc.stats.gpu, ms[total]);
+
+            auto smooth = [](float& avg, float v) { avg = avg > 0.0f ? avg + (v - avg) * 0.1f : v; };
+            if (!slot.followup) {
+                smooth(gp.frameMs, ms[total]);
+            } else if (seen[(uint32_t)GpuStage::FrameGen]) {
+                smooth(gp.generatedMs, ms[total]);
+            }
+        }
+        for (uint32_t i = 0; i < GpuProfiler::kStages; ++i) {
+            if (seen[i]) gpu_profile_push(gp, i, ms[i]);
+        }
+
+        if (gp.log && ++gp.sinceReport >= 600) {
+            gp.sinceReport = 0;
+            gpu_profile_report(gp);
+        }
+    }
+}
+
+/* ------------------------------ HUD ------------------------------ */
+
+// Forgets frame times from before the HUD was switched on or the session
+// started
+void hud_reset(Hud& hud)
+{
+    std::fill(hud.graph, hud.graph + Hud::kGraph, 0.0f);
+    hud.graphHead = 0;
+    hud.graphCount = 0;
+    hud.lastPresent = {};
+    hud.windowStart = std::chrono::steady_clock::now();
+    hud.presents = hud.generated = hud.frames = hud.latencies = 0;
+    hud.cpuMs = hud.latencySumMs = hud.latencyMs = 0.0;
+}
+
+// Pass and buffer are made the first time the HUD is switched on
+void hud_set_enabled(VulkanContext& vc, bool on)
+{
+    Hud& hud = vc.hud;
+    if (on && (!vc.swapStorage || !vc.storageWriteWithoutFormat)) {
+        std::fprintf(stderr, "HUD needs unformatted storage writes to the swapchain, not available\n");
+        on = false;
+    }
+    if (on && !hud.pass.pipeline) {
+        // swapchain image, text and graph
+        create_compute_pass(
+            vc, hud.pass,
+            kHudOverlaySpv, sizeof(kHudOverlaySpv),
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+            sizeof(int32_t) * 6 + sizeof(float) * 2
+        );
+
+        VkBufferCreateInfo bci{};
+        bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bci.size = sizeof(Hud::Data);
+        bci.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        vk_check(vkCreateBuffer(vc.device, &bci, nullptr, &hud.buffer), "vkCreateBuffer hud");
+        hud.memory = gpu_alloc_buffer(
+            vc, hud.buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            AllocStrategy::Pool);
+        hud.data = static_cast<Hud::Data*>(gpu_map(vc, hud.memory));
+        std::memset(hud.data, ' ', sizeof(hud.data->text));
+        std::fill(hud.data->graph, hud.data->graph + Hud::kGraph, 0.0f);
+        write_buffer_descriptor(vc, hud.pass.sets[0], 1, hud.buffer);
+    }
+    hud.enabled = on;
+    hud_reset(hud);
+}
+
+void destroy_hud(VulkanContext& vc)
+{
+    Hud& hud = vc.hud;
+    destroy_compute_pass(vc, hud.pass);
+    if (hud.buffer) vkDestroyBuffer(vc.device, hud.buffer, nullptr);
+    gpu_free(vc, hud.memory);
+    hud.buffer = VK_NULL_HANDLE;
+    hud.data = nullptr;
+    hud.enabled = false;
+}
+
+void hud_note_present(Hud& hud, bool generated)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (hud.lastPresent.time_since_epoch().count() != 0) {
+        hud.graph[hud.graphHead] = std::chrono::duration<float, std::milli>(now - hud.lastPresent).count();
+        hud.graphHead = (hud.graphHead + 1) % Hud::kGraph;
+        hud.graphCount = std::min(hud.graphCount + 1, Hud::kGraph);
+    }
+    hud.lastPresent = now;
+    ++hud.presents;
+    if (generated) ++hud.generated;
+}
+
+// cpuMs: our own work on a source frame (capture, upload, record, submit),
+// not the present call, which may block on the display
+void hud_note_frame(Hud& hud, double cpuMs)
+{
+    hud.cpuMs += cpuMs;
+    ++hud.frames;
+}
+
+// A capture-to-photon sample as it is resolved (photon_record)
+void hud_note_latency(Hud& hud, double ms)
+{
+    hud.latencySumMs += ms;
+    ++hud.latencies;
+}
+
+static void hud_line(Hud::Data& data, uint32_t row, const char* text)
+{
+    uint32_t i = 0;
+    for (; i < Hud::kCols && text[i]; ++i) {
+        data.text[row][i] = (char)std::toupper((unsigned char)text[i]);
+    }
+    for (; i < Hud::kCols; ++i) data.text[row][i] = ' ';
+}
+
+// After the frame fence, before recording: nothing reads the buffer
+void hud_update(VulkanContext& vc, const FSRContext& fc, const SourceClock& source)
+{
+    Hud& hud = vc.hud;
+    if (!hud.enabled || !hud.data) return;
+
+    std::copy(hud.graph, hud.graph + Hud::kGraph, hud.data->graph);
+    hud.dataHead = hud.graphHead;
+    hud.budgetMs = 1000.0f / std::max(fc.frameGen.refreshHz, 1.0f);
+
+    auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - hud.windowStart).count();
+    if (elapsed < 0.25) return;
+
+    const GpuProfiler& gp = vc.profiler;
+    auto gpu = [&](GpuStage stage) { return gpu_profile_stats(gp, stage).avgMs; };
+
+    float sorted[Hud::kGraph];
+    const uint32_t filled = hud.graphCount;
+    std::copy(hud.graph, hud.graph + filled, sorted);
+    std::sort(sorted, sorted + filled);
+
+    char line[Hud::kCols + 1];
+    std::snprintf(line, sizeof(line), "SRC %5.1f FPS  OUT %5.1f FPS  GEN %3.0f%%",
+                  source.intervalMs > 0.0 ? 1000.0 / source.intervalMs : 0.0,
+                  hud.presents / elapsed,
+                  hud.presents ? 100.0 * hud.generated / hud.presents : 0.0);
+    hud_line(*hud.data, 0, line);
+    // Display times arrive a frame or more late, so a window can have none
+    if (hud.latencies) hud.latencyMs = hud.latencySumMs / hud.latencies;
+    std::snprintf(line, sizeof(line), "CPU %5.2f MS  GPU %5.2f MS  LAT %5.1f MS",
+                  hud.frames ? hud.cpuMs / hud.frames : 0.0, gpu(GpuStage::Submission),
+                  hud.latencyMs);
+    hud_line(*hud.data, 1, line);
+    std::snprintf(line, sizeof(line), "UPLOAD %4.2f  DOWN %4.2f  MOTION %4.2f",
+                  gpu(GpuStage::Upload), gpu(GpuStage::Downscale), gpu(GpuStage::Motion));
+    hud_line(*hud.data, 2, line);
+    std::snprintf(line, sizeof(line), "UPSCALE %4.2f  FRAMEGEN %4.2f  OUT %4.2f",
+                  gpu(GpuStage::Upscale), gpu(GpuStage::FrameGen), gpu(GpuStage::Output));
+    hud_line(*hud.data, 3, line);
+    std::snprintf(line, sizeof(line), "FRAME TIME 0-%.0f MS  P99 %.1f MS",
+                  hud.budgetMs * 3.0f, filled ? sorted[filled * 99 / 100] : 0.0f);
+    hud_line(*hud.data, 4, line);
+
+    hud.windowStart = now;
+    hud.presents = hud.generated = hud.frames = hud.latencies = 0;
+    hud.cpuMs = hud.latencySumMs = 0.0;
+}
+
+// Last thing in a submission: the swapchain image has been handed to present
+// already and comes back for the panel
+void record_hud(VulkanContext& vc, VkCommandBuffer cmd, uint32_t imageIndex)
+{
+    Hud& hud = vc.hud;
+    if (!hud.enabled || !hud.data || !vc.swapStorage || vc.swapViews.empty()) return;
+
+    VkDescriptorSet set = hud.pass.sets[0];
+    write_image_descriptor(vc, set, 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                           vc.swapViews[imageIndex], VK_IMAGE_LAYOUT_GENERAL);
+
+    // PRESENT_SRC implies no source stage; chain to whatever wrote the image
     VkImage swapImg = vc.swapImages[imageIndex];
+    BarrierBatch batch;
+    barrier_add(cmd, batch, swapImg, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_GENERAL,
+                VK_IMAGE_ASPECT_COLOR_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    barrier_flush(cmd, batch);
+
+    const int32_t scale = std::max(1, (int32_t)vc.swapExtent.height / 720);
+    struct {
+        int32_t ox, oy;
+        int32_t dstW, dstH;
+        int32_t scale;
+        int32_t graphHead;
+        float graphMaxMs;
+        float budgetMs;
+    } pc{
+        8 * scale, 8 * scale,
+        (int32_t)vc.swapExtent.width, (int32_t)vc.swapExtent.height,
+        scale,
+        (int32_t)hud.dataHead,
+        hud.budgetMs * 3.0f,
+        hud.budgetMs
+    };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hud.pass.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, hud.pass.layout,
+                            0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(cmd, hud.pass.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdDispatch(cmd, (Hud::kPanelW * scale + 7) / 8, (Hud::kPanelH * scale + 7) / 8, 1);
+
+    transition_image_layout(cmd, swapImg, VK_IMAGE_LAYOUT_GENERAL,
+                            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_ASPECT_COLOR_BIT);
+    gpu_profile_mark(vc, cmd, GpuStage::Output);
+}
+
+/* ------------------- Capture-to-photon latency ------------------- */
+
+static const char* photon_clock_name(const PhotonLatency& pl)
+{
+    switch (pl.method) {
+    case PhotonLatency::Method::DisplayTiming: return "from display timing";
+    case PhotonLatency::Method::PresentWait:   return "from present wait";
+    default:                                   return "estimated";
+    }
+}
+
+// When a source frame changed: its XDamage stamp, else capture start. X
+// server time is CLOCK_MONOTONIC in ms truncated to 32 bits on Linux, the
+// clock steady_clock reads; a stamp that doesn't fall within the last
+// second is from some other clock and not used.
+std::chrono::steady_clock::time_point photon_origin(
+    double stampMs, std::chrono::steady_clock::time_point fallback)
+{
+    if (stampMs < 0.0) return fallback;
+    const auto now = std::chrono::steady_clock::now();
+    const uint32_t nowMs = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        now.time_since_epoch()).count();
+    const uint32_t age = nowMs - (uint32_t)(uint64_t)stampMs;
+    if (age > 1000) return fallback;
+    return now - std::chrono::milliseconds(age);
+}
+
+// ID for the next present, which shows a source frame; 0 when nothing is
+// tracked by ID
+uint64_t photon_begin(VulkanContext& vc)
+{
+    return vc.photon.method == PhotonLatency::Method::Estimate ? 0 : vc.photon.nextId++;
+}
+
+// A resolved capture-to-photon time, into the session stats and the HUD
+static void photon_record(VulkanContext& vc, double ms)
+{
+    histogram_record(vc.stats.captureToPhoton, ms);
+    hud_note_latency(vc.hud, ms);
+}
+
+// The present tagged `presentId` returned successfully at presentedAt. The
+// estimate without a display time: one refresh interval after that.
+void photon_presented(VulkanContext& vc, uint64_t presentId,
+                      std::chrono::steady_clock::time_point origin,
+                      std::chrono::steady_clock::time_point presentedAt, float refreshHz)
+{
+    PhotonLatency& pl = vc.photon;
+    if (pl.method == PhotonLatency::Method::Estimate) {
+        const double ms = std::chrono::duration<double, std::milli>(presentedAt - origin).count() +
+                          1000.0 / std::max(refreshHz, 1.0f);
+        photon_record(vc, ms);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pl.mutex);
+    if (pl.count == PhotonLatency::kPending) {   // never resolved, drop
+        pl.head = (pl.head + 1) % PhotonLatency::kPending;
+        --pl.count;
+        ++pl.lost;
+    }
+    PhotonLatency::Pending& p = pl.pending[(pl.head + pl.count) % PhotonLatency::kPending];
+    p.id = presentId;
+    p.origin = origin;
+    p.since = presentedAt;
+    ++pl.count;
+    pl.wake.notify_one();
+}
+
+// Present-wait thread: polls the oldest pending present with a zero
+// timeout and sleeps kPollInterval between polls, outside the swapchain
+// lock, so the main thread waits for at most one poll. A present found done
+// was shown between the last poll that saw it pending and this one; it is
+// stamped halfway. A gap wider than 2 * kImpreciseMs (the main thread held
+// the swapchain, a long acquire, the thread slept late) is kept but counted.
+static void photon_wait_thread(VulkanContext& vc)
+{
+    trace_thread_name("present-wait");
+    PhotonLatency& pl = vc.photon;
+    std::unique_lock<std::mutex> lock(pl.mutex);
+    while (!pl.stop) {
+        if (!pl.count) {
+            pl.wake.wait(lock);
+            continue;
+        }
+        lock.unlock();
+        PhotonLatency::Pending p;
+        VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+        VkResult r = VK_TIMEOUT;
+        {
+            std::lock_guard<std::mutex> swapchainLock(pl.swapchainMutex);
+            lock.lock();
+            const bool any = pl.count != 0;
+            if (any) {
+                p = pl.pending[pl.head];
+                swapchain = pl.swapchain;
+            }
+            lock.unlock();
+            if (any) r = pl.waitForPresent(vc.device, swapchain, p.id, 0);
+        }
+        const auto polledAt = std::chrono::steady_clock::now();
+
+        lock.lock();
+        if (swapchain && pl.count && pl.swapchain == swapchain && pl.pending[pl.head].id == p.id) {
+            if (r == VK_TIMEOUT) {
+                pl.pending[pl.head].since = polledAt;
+            } else {
+                const auto halfGap = (polledAt - p.since) / 2;
+                if (r != VK_SUCCESS && r != VK_SUBOPTIMAL_KHR) {
+                    ++pl.lost;
+                } else if (pl.resolvedCount == PhotonLatency::kPending) {
+                    ++pl.lost;   // photon_collect is behind
+                } else {
+                    if (std::chrono::duration<double, std::milli>(halfGap).count() >
+                        PhotonLatency::kImpreciseMs) {
+                        ++pl.imprecise;
+                    }
+                    pl.resolvedMs[pl.resolvedCount++] =
+                        std::chrono::duration<float, std::milli>(p.since + halfGap - p.origin).count();
+                }
+                pl.head = (pl.head + 1) % PhotonLatency::kPending;
+                --pl.count;
+                continue;   // the next one may be done already
+            }
+        }
+        pl.wake.wait_for(lock, PhotonLatency::kPollInterval, [&pl]() { return pl.stop; });
+    }
+}
+
+void photon_start(VulkanContext& vc)
+{
+    if (vc.photon.method == PhotonLatency::Method::PresentWait) {
+        vc.photon.waiter = std::thread([&vc]() { photon_wait_thread(vc); });
+    }
+}
+
+void photon_stop(VulkanContext& vc)
+{
+    PhotonLatency& pl = vc.photon;
+    if (!pl.waiter.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(pl.mutex);
+        pl.stop = true;
+    }
+    pl.wake.notify_one();
+    pl.waiter.join();
+}
+
+// Takes in display times that have come in; call after the frame fence,
+// never blocks
+void photon_collect(VulkanContext& vc)
+{
+    PhotonLatency& pl = vc.photon;
+    if (pl.method == PhotonLatency::Method::PresentWait) {
+        std::lock_guard<std::mutex> lock(pl.mutex);
+        for (uint32_t i = 0; i < pl.resolvedCount; ++i) {
+            photon_record(vc, pl.resolvedMs[i]);
+        }
+        vc.stats.photonImprecise += pl.imprecise;
+        vc.stats.photonLost += pl.lost;
+        pl.resolvedCount = pl.imprecise = pl.lost = 0;
+        return;
+    }
+    vc.stats.photonLost += pl.lost;
+    pl.lost = 0;
+    if (pl.method != PhotonLatency::Method::DisplayTiming || !pl.count) return;
+
+    VkPastPresentationTimingGOOGLE timings[PhotonLatency::kPending];
+    uint32_t n = PhotonLatency::kPending;
+    VkResult r = pl.pastTiming(vc.device, pl.swapchain, &n, timings);
+    if (r != VK_SUCCESS && r != VK_INCOMPLETE) return;
+    for (uint32_t i = 0; i < n && pl.count; ++i) {
+        // Oldest first; tagged presents it skips were never shown
+        while (pl.count &&
+               (int32_t)(timings[i].presentID - (uint32_t)pl.pending[pl.head].id) > 0) {
+            pl.head = (pl.head + 1) % PhotonLatency::kPending;
+            --pl.count;
+        }
+        if (!pl.count || (uint32_t)pl.pending[pl.head].id != timings[i].presentID) continue;
+        // actualPresentTime is CLOCK_MONOTONIC ns, like steady_clock
+        const int64_t originNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            pl.pending[pl.head].origin.time_since_epoch()).count();
+        photon_record(vc, ((int64_t)timings[i].actualPresentTime - originNs) / 1e6);
+        pl.head = (pl.head + 1) % PhotonLatency::kPending;
+        --pl.count;
+    }
+}
+
+/* --------- Record copy from staging buffer to swapchain image -------- */
+
+// Swapchain image in TRANSFER_DST: black where the letterbox bars go
+static void record_clear_bars(VulkanContext& vc, VkCommandBuffer cmd, VkImage swapImg)
+{
+    if (!display_cropped(vc)) return;
+
+    VkClearColorValue black{};
+    VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdClearColorImage(cmd, swapImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &range);
+
+    VkMemoryBarrier mb{};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+}
+
+// Cheap path used while the upscaler isn't ready: linear blit of the capture
+// (`src`, TRANSFER_SRC) straight into the swapchain image.
+void record_blit_fallback(VulkanContext& vc, VkCommandBuffer cmd, VkImage src, VkImage swapImg)
+{
+    acquire_swap_image(cmd, swapImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    record_clear_bars(vc, cmd, swapImg);
+
+    const VkRect2D& dst = vc.displayRect;
+    VkImageBlit blit{};
+    blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    blit.srcOffsets[0]  = { 0, 0, 0 };
+    blit.srcOffsets[1]  = { (int)vc.activeRect.extent.width, (int)vc.activeRect.extent.height, 1 };
+
+    blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    blit.dstOffsets[0]  = { dst.offset.x, dst.offset.y, 0 };
+    blit.dstOffsets[1]  = { dst.offset.x + (int)dst.extent.width, dst.offset.y + (int)dst.extent.height, 1 };
+
+    vkCmdBlitImage(
+        cmd,
+        src,     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        swapImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit,
+        VK_FILTER_LINEAR
+    );
 
     transition_image_layout(
         cmd, swapImg,
-        VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
+}
+
+// Display-sized GENERAL image -> swapchain image, ending in PRESENT_SRC.
+// The picture is at the origin of src and goes to vc.displayRect.
+void record_copy_to_swap(VulkanContext& vc, VkCommandBuffer cmd, VkImage src, VkImage swapImg)
+{
+    acquire_swap_image(cmd, swapImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    record_clear_bars(vc, cmd, swapImg);
 
     VkImageCopy copyToSwap{};
     copyToSwap.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1213,74 +5209,347 @@ void record_upscale_and_present(
     copyToSwap.dstSubresource.mipLevel = 0;
     copyToSwap.dstSubresource.baseArrayLayer = 0;
     copyToSwap.dstSubresource.layerCount = 1;
-    copyToSwap.dstOffset = {0, 0, 0};
-    copyToSwap.extent = {vc.displayExtent.width, vc.displayExtent.height, 1};
+    copyToSwap.dstOffset = {vc.displayRect.offset.x, vc.displayRect.offset.y, 0};
+    copyToSwap.extent = {vc.displayRect.extent.width, vc.displayRect.extent.height, 1};
 
     vkCmdCopyImage(
         cmd,
-        vc.outputColorImage, VK_IMAGE_LAYOUT_GENERAL,
+        src, VK_IMAGE_LAYOUT_GENERAL,
         swapImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1, &copyToSwap
     );
 
     transition_image_layout(
-        cmd, swapImg,
+        cmd, swapImg,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_IMAGE_ASPECT_COLOR_BIT
+    );
+}
+
+// Replace your record_copy_to_swap_image function with this enhanced version.
+// Returns true when more frames of this group are owed
+// (present_followup_frames): the real one after a generated frame, or the
+// predicted ones after an extrapolation base frame.
+bool record_upscale_and_present(
+    VulkanContext& vc,
+    FSRContext& fc,
+    uint32_t imageIndex,
+    float deltaTime,
+    uint32_t frameCount)
+{
+    TRACE_ZONE("record");
+    VkCommandBuffer cmd = vc.cmdBuffers[imageIndex];
+    vk_check(vkResetCommandBuffer(cmd, 0), "vkResetCommandBuffer");
+
+    VkCommandBufferBeginInfo bi{};
+    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vk_check(vkBeginCommandBuffer(cmd, &bi), "vkBeginCommandBuffer");
+    gpu_profile_begin(vc, cmd);
+
+    if (spatial_fused_usable(vc, fc)) {
+        record_spatial_fused(vc, cmd, imageIndex);
+        gpu_profile_mark(vc, cmd, GpuStage::Upscale);
+        record_hud(vc, cmd, imageIndex);
+        gpu_profile_end(vc);
+        fc.frameGen.outputHistoryValid = false;
+        vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+        return false;
+    }
+
+    // STEP 1: Copy captured data from staging buffer to the upload target:
+    // captureColorImage, or inputColorImage itself when they'd be the same size
+    const bool separateCapture = vc.captureColorImage != VK_NULL_HANDLE;
+    VkImage uploadImg = separateCapture ? vc.captureColorImage : vc.inputColorImage;
+    transition_image_layout(
+        cmd, uploadImg,
+        separateCapture ? VK_IMAGE_LAYOUT_UNDEFINED : vc.inputColorLayout,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_ASPECT_COLOR_BIT
+    );
+
+    // Staging rows are captureExtent.width texels, the active area at the origin
+    VkBufferImageCopy capCopy{};
+    capCopy.bufferOffset = 0;
+    capCopy.bufferRowLength   = vc.captureExtent.width;
+    capCopy.bufferImageHeight = vc.captureExtent.height;
+    capCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    capCopy.imageSubresource.mipLevel = 0;
+    capCopy.imageSubresource.baseArrayLayer = 0;
+    capCopy.imageSubresource.layerCount = 1;
+    capCopy.imageOffset = {0, 0, 0};
+    capCopy.imageExtent = { vc.activeRect.extent.width, vc.activeRect.extent.height, 1 };
+
+    vkCmdCopyBufferToImage(
+        cmd,
+        vc.stagingBuffer,
+        uploadImg,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &capCopy
+    );
+    gpu_profile_mark(vc, cmd, GpuStage::Upload);
+
+    VkImage swapImg = vc.swapImages[imageIndex];
+
+    if (!fc.m_UpscalingContext && !vc.spatial.enabled) {
+        // Upscaler still being created in the background: bilinear blit
+        transition_image_layout(cmd, uploadImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        if (!separateCapture) vc.inputColorLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        record_blit_fallback(vc, cmd, uploadImg, swapImg);
+        gpu_profile_mark(vc, cmd, GpuStage::Output);
+        record_hud(vc, cmd, imageIndex);
+        gpu_profile_end(vc);
+        fc.frameGen.outputHistoryValid = false;
+        vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+        return false;
+    }
+
+    if (separateCapture) {
+        // --- Blit (scale) full-res capture -> low-res input, active rect only ---
+        BarrierBatch batch;
+        barrier_add(cmd, batch, vc.captureColorImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier_add(cmd, batch, vc.inputColorImage, vc.inputColorLayout,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier_flush(cmd, batch);
+
+        const VkExtent2D activeRender = active_render_extent(vc);
+        VkImageBlit blit{};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        blit.srcOffsets[0]  = { 0, 0, 0 };
+        blit.srcOffsets[1] =  { (int)vc.activeRect.extent.width, (int)vc.activeRect.extent.height, 1 };
+
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        blit.dstOffsets[0]  = { 0, 0, 0 };
+        blit.dstOffsets[1]  = { (int)activeRender.width, (int)activeRender.height, 1 };
+
+        vkCmdBlitImage(
+            cmd,
+            vc.captureColorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            vc.inputColorImage,   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit,
+            VK_FILTER_NEAREST
+        );
+        gpu_profile_mark(vc, cmd, GpuStage::Downscale);
+    }
+
+    // --- Input is now ready for FSR sampling ---
+    transition_image_layout(
+        cmd, vc.inputColorImage,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_IMAGE_ASPECT_COLOR_BIT
     );
+    vc.inputColorLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // The previous pyramid is stale after a reset (new target, resize, ...)
+    record_motion_estimation(vc, cmd, !fc.resetHistory);
+    gpu_profile_mark(vc, cmd, GpuStage::Motion);
+
+    // Own interpolation needs the previous real frame, which FSR is about to
+    // overwrite (FFX frame generation keeps its own copy)
+    FrameGenState& fg = fc.frameGen;
+    int frames = fg.enabled ? fg.activeMultiplier : 1;
+    if (!fg.ownKernels && !framegen_uses_ffx(fg)) frames = 1;
+    const bool ownInterpolation = frames > 1 && !fg.extrapolate && !framegen_uses_ffx(fg) &&
+                                  vc.interpolatedColorImage;
+    const bool canInterpolate = ownInterpolation && fg.outputHistoryValid &&
+                                !fc.resetHistory && !fg.resetHistory;
+    if (canInterpolate) {
+        save_output_history(vc, cmd);
+        gpu_profile_mark(vc, cmd, GpuStage::FrameGen);
+    }
+
+    float jitterX = 0.0f, jitterY = 0.0f;
+    if (vc.spatial.enabled) {
+        // STEP 2+3: incremental spatial upscale into the persistent output
+        record_spatial_upscale(vc, cmd);
+        gpu_profile_mark(vc, cmd, GpuStage::Upscale);
+        fc.resetHistory = false;
+    } else {
+        record_depth_clear_once(vc, cmd);
+
+        // Simple halton sequence for jitter (improves temporal quality)
+        if (frameCount % 2 == 0) {
+            jitterX = 0.5f / vc.renderExtent.width;
+            jitterY = 0.5f / vc.renderExtent.height;
+        }
+
+        if (swap_direct_usable(vc, fc)) {
+            // No copy: FSR writes the swapchain image, which goes to present
+            acquire_swap_image(cmd, swapImg, VK_IMAGE_LAYOUT_GENERAL);
+            dispatch_fsr(vc, fc, cmd, jitterX, jitterY, deltaTime, (int)imageIndex);
+            transition_image_layout(cmd, swapImg, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_ASPECT_COLOR_BIT);
+            gpu_profile_mark(vc, cmd, GpuStage::Upscale);
+            record_hud(vc, cmd, imageIndex);
+            gpu_profile_end(vc);
+
+            // outputColorImage didn't get this frame
+            fc.frameGen.outputHistoryValid = false;
+            fc.frameGen.pairFrames = 1;
+            vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+            return false;
+        }
+
+        // STEP 2: Prepare output image for FSR. The old contents are
+        // discarded, but not before the history copy has read them.
+        {
+            BarrierBatch batch;
+            barrier_add(cmd, batch, vc.outputColorImage,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_ASPECT_COLOR_BIT,
+                        canInterpolate ? VK_PIPELINE_STAGE_TRANSFER_BIT : 0);
+            barrier_flush(cmd, batch);
+        }
+
+        // STEP 3: Run FSR upscaling
+        if (vc.foveation.active) {
+            // FSR on the region of interest, then blended over the periphery
+            record_foveation_inputs(vc, cmd);
+            dispatch_fsr(vc, fc, cmd, jitterX, jitterY, deltaTime, -1);
+            gpu_profile_mark(vc, cmd, GpuStage::Upscale);
+            record_foveation_composite(vc, cmd);
+            gpu_profile_mark(vc, cmd, GpuStage::Composite);
+        } else {
+            dispatch_fsr(vc, fc, cmd, jitterX, jitterY, deltaTime, -1);
+            gpu_profile_mark(vc, cmd, GpuStage::Upscale);
+        }
+    }
+
+    // STEP 4: With frame generation on, this submission shows the first
+    // generated frame (t = 1/N); the rest of the group and the real frame
+    // follow via record_present_followup(). Extrapolation shows the real
+    // frame now and the predicted ones (t = 1 + k/N) after it.
+    bool generated = false;
+    if (frames > 1 && fg.extrapolate && vc.interpolatedColorImage) {
+        fg.pairFrames = frames;
+        fg.outputHistoryValid = true;
+        record_copy_to_swap(vc, cmd, vc.outputColorImage, swapImg);
+        gpu_profile_mark(vc, cmd, GpuStage::Output);
+        record_hud(vc, cmd, imageIndex);
+        gpu_profile_end(vc);
+        vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+        return true;
+    } else if (frames > 1 && framegen_uses_ffx(fg)) {
+        generated = dispatch_framegen(vc, fc, cmd, jitterX, jitterY, deltaTime);
+        gpu_profile_mark(vc, cmd, GpuStage::FrameGen);
+    } else if (ownInterpolation) {
+        if (canInterpolate) {
+            record_interpolate(vc, cmd, 1.0f / (float)frames);
+            gpu_profile_mark(vc, cmd, GpuStage::FrameGen);
+            generated = true;
+        }
+        fg.resetHistory = false;
+    }
+    fg.outputHistoryValid = true;
+    fg.pairFrames = generated ? frames : 1;
+
+    // STEP 5: Copy result to swapchain
+    record_copy_to_swap(vc, cmd, generated ? vc.interpolatedColorImage : vc.outputColorImage, swapImg);
+    gpu_profile_mark(vc, cmd, GpuStage::Output);
+    record_hud(vc, cmd, imageIndex);
+    gpu_profile_end(vc);
 
     vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+    return generated;
 }
 
-void recreate_swapchain(VulkanContext& vc, X11Context& xc)
+// Later submissions of a generated group: another generated frame at t != 1
+// (see record_interpolate), or the real upscaled frame still sitting in
+// outputColorImage.
+void record_present_followup(VulkanContext& vc, FSRContext& fc, uint32_t imageIndex, float t)
 {
-    // Wait until GPU is idle before tearing things down
-    vkDeviceWaitIdle(vc.device);
+    VkCommandBuffer cmd = vc.cmdBuffers[imageIndex];
+    vk_check(vkResetCommandBuffer(cmd, 0), "vkResetCommandBuffer");
 
-    // Destroy / free resources tied to swapchain extent
-    if (!vc.cmdBuffers.empty()) {
-        vkFreeCommandBuffers(
-            vc.device,
-            vc.cmdPool,
-            static_cast<uint32_t>(vc.cmdBuffers.size()),
-            vc.cmdBuffers.data()
-        );
-        vc.cmdBuffers.clear();
-    }
+    VkCommandBufferBeginInfo bi{};
+    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vk_check(vkBeginCommandBuffer(cmd, &bi), "vkBeginCommandBuffer");
 
-    if (vc.stagingBuffer) {
-        vkDestroyBuffer(vc.device, vc.stagingBuffer, nullptr);
-        vc.stagingBuffer = VK_NULL_HANDLE;
+    gpu_profile_begin(vc, cmd, true);
+    if (t != 1.0f) {
+        record_interpolate(vc, cmd, t);
+        gpu_profile_mark(vc, cmd, GpuStage::FrameGen);
+        record_copy_to_swap(vc, cmd, vc.interpolatedColorImage, vc.swapImages[imageIndex]);
+    } else {
+        record_copy_to_swap(vc, cmd, vc.outputColorImage, vc.swapImages[imageIndex]);
     }
-    if (vc.stagingMemory) {
-        vkFreeMemory(vc.device, vc.stagingMemory, nullptr);
-        vc.stagingMemory = VK_NULL_HANDLE;
+    gpu_profile_mark(vc, cmd, GpuStage::Output);
+    record_hud(vc, cmd, imageIndex);
+    gpu_profile_end(vc);
+
+    vk_check(vkEndCommandBuffer(cmd), "vkEndCommandBuffer");
+}
+
+// Non-blocking: the old swapchain keeps presenting until the new one exists and
+// is only destroyed once the new one has presented (see release_retired_swapchain).
+// Staging and command buffers don't depend on the display extent and stay.
+void recreate_swapchain(VulkanContext& vc, X11Context& xc)
+{
+    // xc.outW/outH are kept current by ConfigureNotify, no round trip needed
+    create_swapchain(vc, xc.outW, xc.outH);     // updates vc.swapExtent
+    ensure_command_buffers(vc);
+}
+
+// The frame fence covers submits, not the presents queued on the old
+// swapchain. Once the new one has presented twice the old one has nothing
+// left to show; a queue idle wait then covers its last present.
+// force: tear down regardless (cleanup, after vkDeviceWaitIdle).
+void release_retired_swapchain(VulkanContext& vc, bool force = false)
+{
+    if (vc.retiredSwapchain) {
+        if (!force && vc.retiredPresents < 2) return;
+        if (!force) vk_check(vkQueueWaitIdle(vc.queue), "vkQueueWaitIdle retiredSwapchain");
+        vkDestroySwapchainKHR(vc.device, vc.retiredSwapchain, nullptr);
+        vc.retiredSwapchain = VK_NULL_HANDLE;
     }
+    for (VkImageView v : vc.retiredSwapViews) vkDestroyImageView(vc.device, v, nullptr);
+    vc.retiredSwapViews.clear();
+}
 
-    if (vc.swapchain) {
-        vkDestroySwapchainKHR(vc.device, vc.swapchain, nullptr);
-        vc.swapchain = VK_NULL_HANDLE;
+// Rebuild only what is sized by the display: the output image, and the FSR
+// context if the new size no longer fits the one it was created for.
+void resize_display_resources(VulkanContext& vc, FSRContext& fc)
+{
+    if (vc.swapExtent.width  == vc.displayExtent.width &&
+        vc.swapExtent.height == vc.displayExtent.height) {
+        return;
     }
 
-    // Ask X11 what the new window size is
-    XWindowAttributes attrs;
-    if (!XGetWindowAttributes(xc.dpy, xc.vkWindow, &attrs)) {
-        fatal("XGetWindowAttributes failed in recreate_swapchain");
+    // The in-flight frame may still write outputColorImage
+    vk_check(vkWaitForFences(vc.device, 1, &vc.inFlight, VK_TRUE, UINT64_MAX),
+             "vkWaitForFences resize");
+
+    vc.displayExtent = vc.swapExtent;
+    update_display_rect(vc);
+    destroy_output_image(vc);
+    create_output_image(vc);
+    if (vc.foveation.colorImage) {
+        destroy_foveation_resources(vc);
+        create_foveation_resources(vc);
     }
-    xc.outW  = attrs.width;
-    xc.outH = attrs.height;
+    if (vc.spatial.enabled && vc.spatial.upscalePass.pipeline) spatial_bind_output(vc);
 
-    // Rebuild swapchain + dependent resources at new size
-    create_swapchain(vc, xc.outW, xc.outH);     // updates vc.swapExtent
-    create_command_pool_and_buffers(vc);
-    create_staging_buffer(vc);
+    if (!fsr_context_fits(vc, fc)) {
+        release_fsr_context(fc);
+        initFSR(vc, fc);
+    }
+    fc.resetHistory = true;
 }
 
 void update_target_pixmap_if_needed(X11Context& xc)
 {
     XWindowAttributes attrs;
-    if (!XGetWindowAttributes(xc.dpy, xc.targetWindow, &attrs)) {
+    Status ok;
+    {
+        TRACE_ZONE("XGetWindowAttributes");
+        ok = XGetWindowAttributes(xc.dpy, xc.targetWindow, &attrs);
+    }
+    if (!ok) {
         std::fprintf(stderr, "XGetWindowAttributes on targetWindow failed\n");
         return;
     }
@@ -1394,22 +5663,40 @@ void make_fullscreen(X11Context& xc)
 //     XFlush(xc.dpy);
 // }
 
+// Current mode's refresh rate, 60 if RandR can't tell
+double query_refresh_rate(const X11Context& xc)
+{
+    double hz = 60.0;
+    if (XRRScreenConfiguration* conf = XRRGetScreenInfo(xc.dpy, xc.root)) {
+        short rate = XRRConfigCurrentRate(conf);
+        if (rate > 0) hz = rate;
+        XRRFreeScreenConfigInfo(conf);
+    }
+    return hz;
+}
+
 void setup_focus_on_target(X11Context& xc)
 {
     // Give keyboard focus to the source window
     XSetInputFocus(xc.dpy, xc.targetWindow, RevertToParent, CurrentTime);
 }
 
+// Ctrl+Alt+S starts/stops a session, Ctrl+Alt+G toggles frame generation,
+// Ctrl+Alt+E switches it between interpolation and extrapolation, Ctrl+Alt+T
+// writes the CPU trace, Ctrl+Alt+H toggles the HUD, Ctrl+Alt+P prints the
+// frame stats
 void grab_toggle_hotkey(X11Context& xc)
 {
-    KeyCode keycode = XKeysymToKeycode(xc.dpy, XK_s);
     unsigned int modifiers = ControlMask | Mod1Mask; // Ctrl + Alt
 
     // Grab with and without NumLock / CapsLock
     const unsigned int locks[] = { 0, LockMask, Mod2Mask, (unsigned)(LockMask | Mod2Mask) };
 
-    for (unsigned int lock : locks) {
-        XGrabKey(xc.dpy, keycode, modifiers | lock, xc.root, False, GrabModeAsync, GrabModeAsync);
+    for (KeySym sym : { XK_s, XK_g, XK_e, XK_t, XK_h, XK_p }) {
+        KeyCode keycode = XKeysymToKeycode(xc.dpy, sym);
+        for (unsigned int lock : locks) {
+            XGrabKey(xc.dpy, keycode, modifiers | lock, xc.root, False, GrabModeAsync, GrabModeAsync);
+        }
     }
 
     XSelectInput(xc.dpy, xc.root, KeyPressMask);
@@ -1417,50 +5704,268 @@ void grab_toggle_hotkey(X11Context& xc)
 }
 
 
-/* ------------------------------ Cleanup ------------------------------ */
+/* -------------------------- VRAM budget --------------------------- */
 
-void cleanup_session(VulkanContext& vc, X11Context& xc, CaptureBuffer& cb)
+VkExtent2D scaled_render_extent(const VulkanContext& vc)
 {
-    if (vc.device != VK_NULL_HANDLE) {
-        vkDeviceWaitIdle(vc.device);
+    return {
+        std::max(1u, (uint32_t)(vc.captureExtent.width  * vc.renderScale)),
+        std::max(1u, (uint32_t)(vc.captureExtent.height * vc.renderScale))
+    };
+}
 
-        if (vc.stagingBuffer) vkDestroyBuffer(vc.device, vc.stagingBuffer, nullptr);
-        if (vc.stagingMemory) vkFreeMemory(vc.device, vc.stagingMemory, nullptr);
+void memory_budget_query(VulkanContext& vc)
+{
+    MemoryBudget& mb = vc.budget;
+    const VkPhysicalDeviceMemoryProperties& mp = vc.allocator.memProps;
+    mb.heapCount = mp.memoryHeapCount;
+
+    if (mb.supported) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT bp{};
+        bp.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 p2{};
+        p2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        p2.pNext = &bp;
+        vkGetPhysicalDeviceMemoryProperties2(vc.physDevice, &p2);
+        for (uint32_t h = 0; h < mb.heapCount; ++h) {
+            mb.budget[h] = bp.heapBudget[h];
+            mb.usage[h]  = bp.heapUsage[h];
+        }
+    } else {
+        // Blind to FFX, the swapchain and other processes: keep a margin
+        for (uint32_t h = 0; h < mb.heapCount; ++h) {
+            mb.budget[h] = mp.memoryHeaps[h].size / 10 * 8;
+            mb.usage[h]  = vc.allocator.heapReserved[h];
+        }
+    }
+}
 
-        if (vc.imageAvailable) vkDestroySemaphore(vc.device, vc.imageAvailable, nullptr);
-        if (vc.renderFinished) vkDestroySemaphore(vc.device, vc.renderFinished, nullptr);
-        if (vc.inFlight) vkDestroyFence(vc.device, vc.inFlight, nullptr);
+// Device-local heaps only, those are the ones that run out
+void memory_budget_report(VulkanContext& vc)
+{
+    memory_budget_query(vc);
+    const MemoryBudget& mb = vc.budget;
+    const double MiB = 1024.0 * 1024.0;
+    for (uint32_t h = 0; h < mb.heapCount; ++h) {
+        if (!(vc.allocator.memProps.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+        std::printf("VRAM heap %u: %.0f / %.0f MiB budget%s, ours %.0f MiB\n",
+                    h, mb.usage[h] / MiB, mb.budget[h] / MiB,
+                    mb.supported ? "" : " (estimated)",
+                    vc.allocator.heapReserved[h] / MiB);
+    }
+}
 
-        if (vc.cmdPool) vkDestroyCommandPool(vc.device, vc.cmdPool, nullptr);
-        if (vc.swapchain) vkDestroySwapchainKHR(vc.device, vc.swapchain, nullptr);
-        if (vc.surface) vkDestroySurfaceKHR(vc.instance, vc.surface, nullptr);
+// Session images again, at the current render scale and scaler. The frame
+// fence has been waited on. The old FSR contexts were sized for the old
+// render extent or aren't wanted at all, so they are freed, not parked.
+static void rebuild_session_images(VulkanContext& vc, FSRContext& fc)
+{
+    destroy_framegen(vc, fc);
+    cleanup_fsr(vc, fc);
+    poll_fsr_init_async(fc, true);
+    fsr_cache_clear(fc.cache);
 
-        vkDestroyDevice(vc.device, nullptr);
+    vc.renderExtent = scaled_render_extent(vc);
+    create_fsr_images(vc);
+    initFSR(vc, fc);
+    fc.frameGen.resetHistory = true;
+    vc.spatial.outputValid = false;
+}
+
+// One step, cheapest loss first. Returns true when the session images were
+// rebuilt.
+static bool memory_budget_degrade(VulkanContext& vc, FSRContext& fc)
+{
+    MemoryBudget& mb = vc.budget;
+
+    if (fc.frameGen.enabled) {
+        fc.frameGen.enabled = false;
+        mb.framegenDropped = true;
+        destroy_framegen(vc, fc);
+        std::printf("VRAM low: frame generation off, stays off until restart\n");
+        return false;
+    }
+    if (vc.renderScale > MemoryBudget::kMinRenderScale) {
+        vc.renderScale = std::max(vc.renderScale * 0.75f, MemoryBudget::kMinRenderScale);
+        rebuild_session_images(vc, fc);
+        std::printf("VRAM low: render scale %.0f%% (%ux%u)\n", vc.renderScale * 100.0f,
+                    vc.renderExtent.width, vc.renderExtent.height);
+        return true;
+    }
+    if (!vc.spatial.enabled && vc.storageWriteWithoutFormat) {
+        if (!vc.spatial.upscalePass.pipeline) create_spatial_passes(vc);
+        vc.spatial.enabled = true;
+        rebuild_session_images(vc, fc);
+        std::printf("VRAM low: spatial scaler instead of FSR\n");
+        return true;
     }
+    if (!mb.exhausted) {
+        mb.exhausted = true;
+        std::fprintf(stderr, "VRAM low: nothing left to give up\n");
+    }
+    return false;
+}
 
-    if (vc.instance != VK_NULL_HANDLE) {
-        vkDestroyInstance(vc.instance, nullptr);
+// Once a second, after the frame fence. Returns true when the session
+// images were rebuilt and hold nothing yet.
+bool memory_budget_check(VulkanContext& vc, FSRContext& fc)
+{
+    MemoryBudget& mb = vc.budget;
+    auto now = std::chrono::steady_clock::now();
+    if (now < mb.nextCheck) return false;
+    mb.nextCheck = now + std::chrono::seconds(1);
+
+    memory_budget_query(vc);
+    bool low = false;
+    for (uint32_t h = 0; h < mb.heapCount; ++h) {
+        if (!(vc.allocator.memProps.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+        if (mb.usage[h] + (VkDeviceSize)(mb.budget[h] * MemoryBudget::kLowHeadroom) > mb.budget[h]) low = true;
     }
+    if (!low) return false;
+
+    mb.nextCheck = now + std::chrono::seconds(MemoryBudget::kSettleSeconds);
+    memory_budget_report(vc);
+    if (!mb.degrade) return false;
+    return memory_budget_degrade(vc, fc);
+}
+
+/* ------------------------------ Cleanup ------------------------------ */
+
+// Only per-target state goes away; device, swapchain, output image and the
+// (now idle) FSR context stay warm for the next session.
+void cleanup_session(VulkanContext& vc, FSRContext& fc, X11Context& xc, CaptureBuffer& cb)
+{
+    // Single frame in flight: once its fence signals the GPU is done with us
+    vk_check(vkWaitForFences(vc.device, 1, &vc.inFlight, VK_TRUE, UINT64_MAX),
+             "vkWaitForFences cleanup_session");
+
+    cleanup_fsr(vc, fc);
+
+    // Persist whatever the session compiled, in case we never exit cleanly
+    save_pipeline_cache(vc);
+
+    if (vc.stagingBuffer) vkDestroyBuffer(vc.device, vc.stagingBuffer, nullptr);
+    gpu_free(vc, vc.stagingMemory);
+    vc.stagingBuffer = VK_NULL_HANDLE;
 
     if (cb.image) {
         XDestroyImage(cb.image);
         cb.image = nullptr;
     }
 
+    if (xc.damage) {
+        XDamageDestroy(xc.dpy, xc.damage);
+        xc.damage = 0;
+    }
     if (xc.targetPixmap) {
         XFreePixmap(xc.dpy, xc.targetPixmap);
         xc.targetPixmap = 0;
     }
+    if (xc.targetWindow) {
+        XCompositeUnredirectWindow(xc.dpy, xc.targetWindow, CompositeRedirectAutomatic);
+        xc.targetWindow = 0;
+    }
     if (xc.vkWindow) {
-        XDestroyWindow(xc.dpy, xc.vkWindow);
-        xc.vkWindow = 0;
+        XUnmapWindow(xc.dpy, xc.vkWindow);
     }
+    XFlush(xc.dpy);
 
     // IMPORTANT: do NOT XCloseDisplay here.
 }
 
+// Application-scope Vulkan state: instance, device, queue, swapchain on the
+// persistent vkWindow, command buffers, sync objects and the output image.
+void init_vulkan(VulkanContext& vc, FSRContext& fc, const X11Context& xc)
+{
+    create_instance(vc);
+    create_xlib_surface(vc, xc);
+    pick_physical_device_and_queue(vc);
+    create_device_and_queue(vc);
+    photon_start(vc);
+    if (!vc.storageWriteWithoutFormat) {
+        FrameGenState& fg = fc.frameGen;
+        fg.ownKernels = false;
+        if (fg.multiplier > 2 || fg.extrapolate) {
+            std::fprintf(stderr, "Frame generation: own kernels unsupported, FFX 2x interpolation only\n");
+            fg.multiplier = fg.activeMultiplier = 2;
+            fg.extrapolate = false;
+        }
+        if (vc.spatial.enabled) {
+            std::fprintf(stderr, "LSFL_SCALER=%s unsupported on this device, using FSR\n",
+                         vc.spatial.fused ? "fused" : "spatial");
+            vc.spatial.enabled = vc.spatial.fused = false;
+        }
+        if (vc.foveation.mode != Foveation::Mode::Off) {
+            std::fprintf(stderr, "LSFL_FOVEATE unsupported on this device, ignored\n");
+            vc.foveation.mode = Foveation::Mode::Off;
+        }
+    }
+    gpu_allocator_init(vc);
+    gpu_profiler_init(vc);
+    create_pipeline_cache(vc);
+    install_ffx_pipeline_cache(vc);
+    create_compute_passes(vc);
+
+    // Warm a display-sized upscaler in the background right away: it fits any
+    // target up to screen size, so the first session usually finds it ready.
+    if (!vc.spatial.enabled) {
+        FSRContextKey prewarm{ { (uint32_t)xc.outW, (uint32_t)xc.outH },
+                               { (uint32_t)xc.outW, (uint32_t)xc.outH },
+                               fsr_context_flags() };
+        start_fsr_init_async(vc, fc, prewarm);
+    }
+
+    create_swapchain(vc, xc.outW, xc.outH);
+    vc.displayExtent = vc.swapExtent;
+    create_command_pool_and_buffers(vc);
+    create_sync_objects(vc);
+    create_output_image(vc);
+}
+
+void cleanup_vulkan(VulkanContext& vc, FSRContext& fc)
+{
+    if (vc.device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(vc.device);
+        photon_stop(vc);
+
+        poll_fsr_init_async(fc, true);
+        release_fsr_context(fc);
+        fsr_cache_clear(fc.cache);
+        destroy_framegen(vc, fc);
+        destroy_compute_passes(vc);
+        destroy_hud(vc);
+        gpu_profiler_destroy(vc);
+        destroy_pipeline_cache(vc);
+        destroy_output_image(vc);
+
+        if (vc.imageAvailable) vkDestroySemaphore(vc.device, vc.imageAvailable, nullptr);
+        if (vc.renderFinished) vkDestroySemaphore(vc.device, vc.renderFinished, nullptr);
+        if (vc.inFlight) vkDestroyFence(vc.device, vc.inFlight, nullptr);
+
+        if (vc.cmdPool) vkDestroyCommandPool(vc.device, vc.cmdPool, nullptr);
+        release_retired_swapchain(vc, true);
+        for (VkImageView v : vc.swapViews) vkDestroyImageView(vc.device, v, nullptr);
+        vc.swapViews.clear();
+        if (vc.swapchain) vkDestroySwapchainKHR(vc.device, vc.swapchain, nullptr);
+        if (vc.surface) vkDestroySurfaceKHR(vc.instance, vc.surface, nullptr);
+
+        gpu_allocator_destroy(vc);
+        vkDestroyDevice(vc.device, nullptr);
+        vc.device = VK_NULL_HANDLE;
+    }
+
+    if (vc.instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(vc.instance, nullptr);
+        vc.instance = VK_NULL_HANDLE;
+    }
+}
+
 void cleanup_app(X11Context& xc)
 {
+    if (xc.vkWindow) {
+        XDestroyWindow(xc.dpy, xc.vkWindow);
+        xc.vkWindow = 0;
+    }
     if (xc.mainWindow) {
         XDestroyWindow(xc.dpy, xc.mainWindow);
         xc.mainWindow = 0;
@@ -1471,54 +5976,218 @@ void cleanup_app(X11Context& xc)
     }
 }
 
-static bool is_toggle_hotkey(const XKeyEvent& k)
+static bool is_hotkey(const XKeyEvent& k, KeySym want_sym)
 {
     KeySym sym = XLookupKeysym(const_cast<XKeyEvent*>(&k), 0);
     const unsigned int want = ControlMask | Mod1Mask;
-    return sym == XK_s && (k.state & want) == want;
+    return sym == want_sym && (k.state & want) == want;
+}
+
+static bool is_toggle_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_s);
+}
+
+static bool is_framegen_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_g);
+}
+
+static bool is_extrapolate_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_e);
+}
+
+static bool is_trace_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_t);
+}
+
+static bool is_hud_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_h);
+}
+
+static bool is_stats_hotkey(const XKeyEvent& k)
+{
+    return is_hotkey(k, XK_p);
+}
+
+// Blocks until a swapchain image is available. While the present-wait thread
+// runs, in kAcquireSliceNs slices with the swapchain lock let go in between,
+// so its polls go on during a long acquire.
+static VkResult acquire_next_image(VulkanContext& vc, uint32_t& imageIndex)
+{
+    TRACE_ZONE("vkAcquireNextImageKHR");
+    const bool sliced = vc.photon.waiter.joinable();
+    for (;;) {
+        auto lock = swapchain_lock(vc.photon);
+        VkResult r = vkAcquireNextImageKHR(vc.device, vc.swapchain,
+                                           sliced ? PhotonLatency::kAcquireSliceNs : UINT64_MAX,
+                                           vc.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+        if (!sliced || r != VK_TIMEOUT) return r;
+        lock.unlock();
+        std::this_thread::yield();
+    }
+}
+
+// Single frame in flight: the caller has waited inFlight and reset it.
+// A non-zero presentId comes from photon_begin; photon_presented follows on
+// success. submittedAt, if given, is set between the submit and the present.
+static VkResult submit_and_present(VulkanContext& vc, uint32_t imageIndex, uint64_t presentId = 0,
+                                   std::chrono::steady_clock::time_point* submittedAt = nullptr)
+{
+    VkPipelineStageFlags waitStage = kAcquireWaitStages;
+    VkSubmitInfo submit{};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &vc.imageAvailable;
+    submit.pWaitDstStageMask = &waitStage;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &vc.cmdBuffers[imageIndex];
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &vc.renderFinished;
+
+    {
+        TRACE_ZONE("vkQueueSubmit");
+        vk_check(vkQueueSubmit(vc.queue, 1, &submit, vc.inFlight), "vkQueueSubmit");
+    }
+    if (submittedAt) *submittedAt = std::chrono::steady_clock::now();
+
+    VkPresentInfoKHR present{};
+    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present.waitSemaphoreCount = 1;
+    present.pWaitSemaphores = &vc.renderFinished;
+    present.swapchainCount = 1;
+    present.pSwapchains = &vc.swapchain;
+    present.pImageIndices = &imageIndex;
+
+    VkPresentIdKHR presentIdInfo{};
+    VkPresentTimeGOOGLE presentTime{};
+    VkPresentTimesInfoGOOGLE presentTimes{};
+    if (presentId && vc.photon.method == PhotonLatency::Method::PresentWait) {
+        presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds = &presentId;
+        present.pNext = &presentIdInfo;
+    } else if (presentId && vc.photon.method == PhotonLatency::Method::DisplayTiming) {
+        presentTime.presentID = (uint32_t)presentId;
+        presentTime.desiredPresentTime = 0;   // as soon as possible
+        presentTimes.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+        presentTimes.swapchainCount = 1;
+        presentTimes.pTimes = &presentTime;
+        present.pNext = &presentTimes;
+    }
+
+    TRACE_ZONE("vkQueuePresentKHR");
+    auto lock = swapchain_lock(vc.photon);
+    VkResult result = vkQueuePresentKHR(vc.queue, &present);
+    if (vc.retiredSwapchain && (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)) {
+        ++vc.retiredPresents;
+    }
+    return result;
+}
+
+// Presents the rest of a generated group: frame k of N goes out k/N of a
+// source interval after the first one. Interpolation ends on the real frame,
+// extrapolation continues past it. Returns the first non-success
+// acquire/present result. `origin` is when the real frame changed.
+static VkResult present_followup_frames(VulkanContext& vc, FSRContext& fc,
+                                        std::chrono::steady_clock::time_point generatedAt,
+                                        std::chrono::steady_clock::time_point origin)
+{
+    FrameGenState& fg = fc.frameGen;
+    const int frames = fg.pairFrames;
+    const auto slot = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(fg.sourceInterval / (float)frames));
+
+    VkResult result = VK_SUCCESS;
+    for (int k = 1; k < frames; ++k) {
+        {
+            TRACE_ZONE("vkWaitForFences");
+            vk_check(vkWaitForFences(vc.device, 1, &vc.inFlight, VK_TRUE, UINT64_MAX),
+                     "vkWaitForFences framegen");
+        }
+        gpu_profile_collect(vc);
+        photon_collect(vc);
+
+        std::this_thread::sleep_until(generatedAt + slot * k);
+
+        uint32_t imageIndex = 0;
+        VkResult acquire = acquire_next_image(vc, imageIndex);
+        if (acquire != VK_SUCCESS && acquire != VK_SUBOPTIMAL_KHR) {
+            return acquire;
+        }
+
+        vk_check(vkResetFences(vc.device, 1, &vc.inFlight), "vkResetFences");
+        const float t = fg.extrapolate ? 1.0f + (float)k / (float)frames
+                                       : (float)(k + 1) / (float)frames;
+        record_present_followup(vc, fc, imageIndex, t);
+        const bool real = t == 1.0f;
+        const uint64_t presentId = real ? photon_begin(vc) : 0;
+        VkResult presRes = submit_and_present(vc, imageIndex, presentId);
+        if (presRes != VK_SUCCESS) return presRes;
+        if (real) photon_presented(vc, presentId, origin, std::chrono::steady_clock::now(), fg.refreshHz);
+        hud_note_present(vc.hud, !real);
+        if (acquire != VK_SUCCESS) result = acquire;
+    }
+    return result;
 }
 
 
-bool run_session(X11Context& xc)
+bool run_session(X11Context& xc, VulkanContext& vc, FSRContext& fc)
 {
+    auto sessionStart = std::chrono::steady_clock::now();
+    bool firstFramePresented = false;
+
     init_x11_copy(xc);
-    VulkanContext vc{};
-    create_instance(vc);
-    create_xlib_surface(vc, xc);
-    pick_physical_device_and_queue(vc);
-    create_device_and_queue(vc);
     
     vc.captureExtent = { (uint32_t)xc.capW, (uint32_t)xc.capH };
-    vc.displayExtent = { (uint32_t)xc.outW, (uint32_t)xc.outH };
 
-    // Lossless path: render at capture res (no half-res)
-    vc.renderExtent = vc.captureExtent;
+    // Lossless path: render at capture res, unless VRAM ran short before
+    vc.renderExtent = scaled_render_extent(vc);
+    vc.activeRect = { { 0, 0 }, vc.captureExtent };
+    update_display_rect(vc);
     
-    create_swapchain(vc, (int)vc.displayExtent.width, (int)vc.displayExtent.height);
-    vc.displayExtent = vc.swapExtent;
-    create_command_pool_and_buffers(vc);
-    create_sync_objects(vc);
     create_staging_buffer(vc);
     
-    // Create FSR images and initialize
+    // Create FSR images and initialize (a warm context comes from the cache)
     create_fsr_images(vc);
-    
-    FSRContext fc{};
     initFSR(vc, fc);
+    memory_budget_report(vc);
 
     CaptureBuffer capture{};
 
+    // Previous session's frames mean nothing for this target
+    fc.frameGen.resetHistory = true;
+    fc.frameGen.refreshHz = query_refresh_rate(xc);
+
+    SourceClock source;
+    source_clock_reset(source);
+    vc.stats = FrameStats{};
+    hud_reset(vc.hud);
+    vc.stats.photonClock = photon_clock_name(vc.photon);
+    std::chrono::steady_clock::time_point lastPresent{};
+    const bool haveDamage = xc.damage != 0;
+    FrameHashes hashes;
+
+    LetterboxDetector letterbox;
+    if (const char* lb = std::getenv("LSFL_LETTERBOX")) {
+        letterbox.enabled = std::strcmp(lb, "0") != 0;
+    }
+
     bool running = true;
     bool app_exit = false;
     
-    auto lastTime = std::chrono::high_resolution_clock::now();
-    uint32_t frameCount = 0;
+    // Configure bursts (make_fullscreen, WM state changes) are coalesced: the
+    // swapchain is rebuilt once the size has been stable for kResizeDebounce,
+    // and the current one keeps presenting in the meantime.
+    const auto kResizeDebounce = std::chrono::milliseconds(50);
+    bool resizePending = false;
+    auto lastConfigure = std::chrono::high_resolution_clock::now();
 
     while (running) {
-        // Calculate delta time
         auto currentTime = std::chrono::high_resolution_clock::now();
-        float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
-        lastTime = currentTime;
         
         while (XPending(xc.dpy)) {
             XEvent ev;
@@ -1535,21 +6204,48 @@ bool run_session(X11Context& xc)
             case KeyPress:
                 if (is_toggle_hotkey(ev.xkey)) {
                     running = false;
+                } else if (is_framegen_hotkey(ev.xkey) && !fc.frameGen.enabled &&
+                           vc.budget.framegenDropped) {
+                    std::fprintf(stderr, "Frame generation stays off: VRAM ran low "
+                                         "(LSFL_VRAM_DEGRADE=0 keeps it)\n");
+                } else if (is_framegen_hotkey(ev.xkey)) {
+                    fc.frameGen.enabled = !fc.frameGen.enabled;
+                    fc.frameGen.resetHistory = true;
+                    std::printf("Frame generation %s\n", fc.frameGen.enabled ? "on" : "off");
+                } else if (is_extrapolate_hotkey(ev.xkey) && !fc.frameGen.ownKernels) {
+                    std::fprintf(stderr, "Extrapolation not supported on this device\n");
+                } else if (is_extrapolate_hotkey(ev.xkey)) {
+                    fc.frameGen.extrapolate = !fc.frameGen.extrapolate;
+                    fc.frameGen.resetHistory = true;
+                    std::printf("Frame generation mode: %s\n",
+                                fc.frameGen.extrapolate ? "extrapolate" : "interpolate");
+                } else if (is_trace_hotkey(ev.xkey)) {
+                    trace_dump();
+                } else if (is_hud_hotkey(ev.xkey)) {
+                    hud_set_enabled(vc, !vc.hud.enabled);
+                } else if (is_stats_hotkey(ev.xkey)) {
+                    frame_stats_print(vc.stats, "so far");
                 }
                 break;
 
             case ConfigureNotify:
                 if (ev.xconfigure.window == xc.vkWindow) {
-                    // Need to recreate FSR images too
-                    vkDeviceWaitIdle(vc.device);
-                    cleanup_fsr(vc, fc);
-                    recreate_swapchain(vc, xc);
-                    
-                    vc.displayExtent = { (uint32_t)xc.outW, (uint32_t)xc.outH };
-                    vc.renderExtent  = vc.captureExtent; // lossless
-                    
-                    create_fsr_images(vc);
-                    initFSR(vc, fc);
+                    xc.outW = ev.xconfigure.width;
+                    xc.outH = ev.xconfigure.height;
+                    // Moves and same-size configures don't touch the swapchain
+                    if ((uint32_t)xc.outW != vc.swapExtent.width ||
+                        (uint32_t)xc.outH != vc.swapExtent.height) {
+                        resizePending = true;
+                    }
+                    if (resizePending) lastConfigure = currentTime;
+                }
+                break;
+
+            default:
+                if (haveDamage && ev.type == xc.damageEventBase + XDamageNotify) {
+                    const XDamageNotifyEvent& dn = reinterpret_cast<const XDamageNotifyEvent&>(ev);
+                    XDamageSubtract(xc.dpy, dn.damage, None, None);
+                    source_clock_damage(source, (double)dn.timestamp);
                 }
                 break;
             }
@@ -1557,79 +6253,186 @@ bool run_session(X11Context& xc)
 
         if (!running) break;
 
+        if (resizePending && currentTime - lastConfigure >= kResizeDebounce) {
+            resizePending = false;
+            recreate_swapchain(vc, xc);
+            resize_display_resources(vc, fc);
+            // The new swapchain needs a frame even if the source is static
+            source.pending = true;
+            frame_hashes_invalidate(hashes);
+        }
+
         update_target_pixmap_if_needed(xc);
 
-        if (!capture_frame(xc, capture)) {
+        // Nothing new from the application: don't re-upscale the same frame,
+        // sleep until X has news (damage, keys, configure)
+        if (haveDamage && !source.pending) {
+            wait_for_x_events(xc, resizePending ? 5 : 100);
+            continue;
+        }
+
+        // Now and then the whole window, to look for bars; otherwise only
+        // the part that isn't bars
+        const auto frameStart = std::chrono::steady_clock::now();
+        const bool probe = letterbox.enabled && ++letterbox.sinceProbe >= LetterboxDetector::kProbeEvery;
+        const VkRect2D& crop = vc.activeRect;
+        const bool captured = probe
+            ? capture_frame(xc, capture, 0, 0, xc.capW, xc.capH)
+            : capture_frame(xc, capture, crop.offset.x, crop.offset.y,
+                            (int)crop.extent.width, (int)crop.extent.height);
+        histogram_record(vc.stats.capture, std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - frameStart).count());
+        if (!captured) {
             continue;
         }
 
-        upload_capture_to_staging(xc, capture, vc);
+        if (probe && capture.originX == 0 && capture.originY == 0) {
+            letterbox.sinceProbe = 0;
+            VkRect2D detected = detect_active_rect(
+                capture.image,
+                std::min<int>(capture.image->width,  (int)vc.captureExtent.width),
+                std::min<int>(capture.image->height, (int)vc.captureExtent.height));
+            if (letterbox_update(letterbox, vc.activeRect, detected)) {
+                update_display_rect(vc);
+                std::printf("Letterbox: active area %ux%u at %d,%d\n",
+                            vc.activeRect.extent.width, vc.activeRect.extent.height,
+                            vc.activeRect.offset.x, vc.activeRect.offset.y);
+                // The picture moved to a new origin: no history survives
+                fc.resetHistory = true;
+                fc.frameGen.resetHistory = true;
+                vc.spatial.outputValid = false;
+                frame_hashes_invalidate(hashes);
+            }
+        }
 
-        vk_check(
-            vkWaitForFences(vc.device, 1, &vc.inFlight, VK_TRUE, UINT64_MAX),
-            "vkWaitForFences"
-        );
-        vk_check(vkResetFences(vc.device, 1, &vc.inFlight), "vkResetFences");
+        // Without XDamage every loop iteration is a candidate frame
+        double stampMs = haveDamage
+            ? source.pendingStampMs
+            : std::chrono::duration<double, std::milli>(currentTime.time_since_epoch()).count();
+        const auto origin = photon_origin(haveDamage ? stampMs : -1.0, frameStart);
+        source.pending = false;
+        source.pendingStampMs = -1.0;
+
+        // Repeated image: nothing to upscale, and it must not count as a
+        // source frame or the rate estimate (and frame generation) would
+        // follow the redraw rate instead of the real one
+        if (!upload_capture_to_staging(xc, capture, vc, hashes)) {
+            source.duplicates++;
+            if (!haveDamage) wait_for_x_events(xc, 1);
+            continue;
+        }
+        source_clock_tick(source, stampMs, &vc.stats.sourceInterval);
+        const auto uploaded = std::chrono::steady_clock::now();
+
+        // FSR's frame time and the frame generation scheduler follow the
+        // application's cadence, not our loop
+        const float deltaTime = source_clock_frame_delta(source);
+        const uint32_t frameCount = (uint32_t)source.frames;
+        fc.frameGen.sourceInterval = (float)(source.intervalMs / 1000.0);
+        update_frame_multiplier(fc, vc.profiler);
+
+        {
+            TRACE_ZONE("vkWaitForFences");
+            vk_check(
+                vkWaitForFences(vc.device, 1, &vc.inFlight, VK_TRUE, UINT64_MAX),
+                "vkWaitForFences"
+            );
+        }
+        release_retired_swapchain(vc);
+        gpu_profile_collect(vc);
+        foveation_report(vc);
+        photon_collect(vc);
+        if (memory_budget_check(vc, fc)) {
+            // New, empty session images: this frame is uploaded from scratch
+            frame_hashes_invalidate(hashes);
+        }
 
         uint32_t imageIndex = 0;
-        VkResult acquire = vkAcquireNextImageKHR(
-            vc.device,
-            vc.swapchain,
-            UINT64_MAX,
-            vc.imageAvailable,
-            VK_NULL_HANDLE,
-            &imageIndex
-        );
+        const auto acquireStart = std::chrono::steady_clock::now();
+        VkResult acquire = acquire_next_image(vc, imageIndex);
 
-        if (acquire == VK_ERROR_OUT_OF_DATE_KHR || acquire == VK_SUBOPTIMAL_KHR) {
-            vkDeviceWaitIdle(vc.device);
-            cleanup_fsr(vc, fc);
+        if (acquire == VK_ERROR_OUT_OF_DATE_KHR) {
+            // Nothing was acquired, the fence stays signaled for the retry
             recreate_swapchain(vc, xc);
-            
-            vc.displayExtent = { (uint32_t)xc.outW, (uint32_t)xc.outH };
-            vc.renderExtent  = vc.captureExtent; // lossless
-            
-            create_fsr_images(vc);
-            initFSR(vc, fc);
+            resize_display_resources(vc, fc);
+            source.pending = true;
+            frame_hashes_invalidate(hashes);
             continue;
+        } else if (acquire == VK_SUBOPTIMAL_KHR) {
+            // Image is still valid: present it and recreate once things settle
+            if (!resizePending) {
+                resizePending = true;
+                lastConfigure = currentTime;
+            }
         } else if (acquire != VK_SUCCESS) {
             std::fprintf(stderr, "vkAcquireNextImageKHR error %d\n", acquire);
             break;
         }
 
-        record_upscale_and_present(vc, fc, imageIndex, deltaTime, frameCount++);
+        // Only reset once a submit is guaranteed to signal it again
+        vk_check(vkResetFences(vc.device, 1, &vc.inFlight), "vkResetFences");
 
-        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        VkSubmitInfo submit{};
-        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submit.waitSemaphoreCount = 1;
-        submit.pWaitSemaphores = &vc.imageAvailable;
-        submit.pWaitDstStageMask = &waitStage;
-        submit.commandBufferCount = 1;
-        submit.pCommandBuffers = &vc.cmdBuffers[imageIndex];
-        submit.signalSemaphoreCount = 1;
-        submit.pSignalSemaphores = &vc.renderFinished;
+        // Switch from the blit path once the background context has landed;
+        // initFSR() takes it from the cache and resets history.
+        if (!fc.m_UpscalingContext && poll_fsr_init_async(fc)) {
+            initFSR(vc, fc);
+        }
 
-        vk_check(vkQueueSubmit(vc.queue, 1, &submit, vc.inFlight), "vkQueueSubmit");
+        // Region of interest for this frame (may drop FSR history if it moved)
+        update_foveation_roi(vc, fc, xc);
 
-        VkPresentInfoKHR present{};
-        present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        present.waitSemaphoreCount = 1;
-        present.pWaitSemaphores = &vc.renderFinished;
-        present.swapchainCount = 1;
-        present.pSwapchains = &vc.swapchain;
-        present.pImageIndices = &imageIndex;
+        // Frame generation rides on the upscaler's inputs; the fence above
+        // makes (re)creating its context safe here
+        if (fc.frameGen.enabled && (fc.m_UpscalingContext || vc.spatial.enabled) &&
+            !init_framegen(vc, fc)) {
+            fc.frameGen.enabled = false;
+        }
 
-        VkResult presRes = vkQueuePresentKHR(vc.queue, &present);
+        hud_update(vc, fc, source);
+        const auto recordStart = std::chrono::steady_clock::now();
+        bool generated = record_upscale_and_present(vc, fc, imageIndex, deltaTime, frameCount);
+
+        // The real frame goes out now unless interpolation puts it last
+        const bool showsSource = !generated || fc.frameGen.extrapolate;
+        const uint64_t presentId = showsSource ? photon_begin(vc) : 0;
+        std::chrono::steady_clock::time_point submitted;
+        VkResult presRes = submit_and_present(vc, imageIndex, presentId, &submitted);
+        auto generatedAt = std::chrono::steady_clock::now();
+        if (presRes == VK_SUCCESS || presRes == VK_SUBOPTIMAL_KHR) {
+            histogram_record(vc.stats.acquireToPresent,
+                             std::chrono::duration<double, std::milli>(generatedAt - acquireStart).count());
+            if (lastPresent.time_since_epoch().count() != 0) {
+                histogram_record(vc.stats.frameTime,
+                                 std::chrono::duration<double, std::milli>(generatedAt - lastPresent).count());
+            }
+            lastPresent = generatedAt;
+            if (showsSource) photon_presented(vc, presentId, origin, generatedAt, fc.frameGen.refreshHz);
+            hud_note_present(vc.hud, generated);
+            hud_note_frame(vc.hud, std::chrono::duration<double, std::milli>(
+                                       (uploaded - frameStart) + (submitted - recordStart)).count());
+        }
+        if (generated && presRes == VK_SUCCESS) {
+            presRes = present_followup_frames(vc, fc, generatedAt, origin);
+        }
+        if (!firstFramePresented) {
+            firstFramePresented = true;
+            std::printf("Time to first frame: %.1f ms\n",
+                        std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - sessionStart).count());
+        }
         if (presRes == VK_ERROR_OUT_OF_DATE_KHR || presRes == VK_SUBOPTIMAL_KHR) {
+            if (!resizePending) {
+                resizePending = true;
+                lastConfigure = currentTime;
+            }
             continue;
         } else if (presRes != VK_SUCCESS) {
             std::fprintf(stderr, "vkQueuePresentKHR error %d\n", presRes);
             break;
         }
     }
-    cleanup_fsr(vc, fc);
-    cleanup_session(vc, xc, capture);
+    frame_stats_print(vc.stats, "session end");
+    cleanup_session(vc, fc, xc, capture);
     return app_exit;
 }
 
@@ -1637,6 +6440,10 @@ bool run_session(X11Context& xc)
 
 int main()
 {
+#ifndef NDEBUG
+    frame_hash_self_check();
+#endif
+
     X11Context xc{};
     xc.dpy = XOpenDisplay(nullptr);
     if (!xc.dpy) fatal("XOpenDisplay failed");
@@ -1644,9 +6451,63 @@ int main()
     xc.root = RootWindow(xc.dpy, xc.screen);
     
     init_x11_main(xc);
+    init_x11_output(xc);
 
     grab_toggle_hotkey(xc);
 
+    // Device, swapchain and FSR context cache live across sessions so that
+    // toggling the hotkey only pays for per-target state.
+    VulkanContext vc{};
+    FSRContext fc{};
+    if (const char* fg = std::getenv("LSFL_FRAMEGEN")) {
+        if (std::strcmp(fg, "auto") == 0) {
+            fc.frameGen.enabled = true;
+            fc.frameGen.adaptive = true;
+        } else {
+            int n = std::atoi(fg);
+            fc.frameGen.enabled = n > 0;
+            fc.frameGen.multiplier = std::clamp(n, 2, 4);   // "1" = on, 2x
+        }
+        fc.frameGen.activeMultiplier = fc.frameGen.multiplier;
+    }
+    if (const char* mode = std::getenv("LSFL_FRAMEGEN_MODE")) {
+        fc.frameGen.extrapolate = std::strcmp(mode, "extrapolate") == 0;
+    }
+    if (const char* scaler = std::getenv("LSFL_SCALER")) {
+        vc.spatial.fused = std::strcmp(scaler, "fused") == 0;
+        vc.spatial.enabled = vc.spatial.fused || std::strcmp(scaler, "spatial") == 0;
+    }
+    if (const char* sharp = std::getenv("LSFL_SHARPNESS")) {
+        vc.spatial.sharpness = std::clamp((float)std::atof(sharp), 0.0f, 1.0f);
+    }
+    if (const char* fov = std::getenv("LSFL_FOVEATE")) {
+        if (std::strcmp(fov, "center") == 0) vc.foveation.mode = Foveation::Mode::Center;
+        if (std::strcmp(fov, "pointer") == 0) vc.foveation.mode = Foveation::Mode::Pointer;
+    }
+    if (const char* size = std::getenv("LSFL_FOVEATE_SIZE")) {
+        vc.foveation.size = std::clamp((float)std::atof(size), 0.2f, 0.9f);
+    }
+    if (const char* feather = std::getenv("LSFL_FOVEATE_FEATHER")) {
+        vc.foveation.feather = std::clamp(std::atoi(feather), 0, 512);
+    }
+    if (const char* degrade = std::getenv("LSFL_VRAM_DEGRADE")) {
+        vc.budget.degrade = std::strcmp(degrade, "0") != 0;
+    }
+    if (const char* trace = std::getenv("LSFL_TRACE")) {
+        g_trace.enabled.store(std::strcmp(trace, "0") != 0, std::memory_order_relaxed);
+    }
+    if (const char* seconds = std::getenv("LSFL_TRACE_SECONDS")) {
+        g_trace.seconds = std::clamp(std::atof(seconds), 0.1, 60.0);
+    }
+    if (const char* file = std::getenv("LSFL_TRACE_FILE")) {
+        g_trace.path = file;
+    }
+    trace_thread_name("main");
+    init_vulkan(vc, fc, xc);
+    if (const char* hud = std::getenv("LSFL_HUD")) {
+        if (std::strcmp(hud, "0") != 0) hud_set_enabled(vc, true);
+    }
+
     bool app_running = true;
 
     while (app_running) {
@@ -1661,13 +6522,14 @@ int main()
         if (ev.type == KeyPress && is_toggle_hotkey(ev.xkey)) {
             // Start session; it will return when Ctrl+Alt+S is pressed again.
             fprintf(stderr, "KeyPress received in main loop\n");
-            bool want_exit = run_session(xc);
+            bool want_exit = run_session(xc, vc, fc);
             if (want_exit) app_running = false;
         }
 
         // handle GUI expose/button/etc here if you want
     }
 
+    cleanup_vulkan(vc, fc);
     cleanup_app(xc);
     return 0;
 }
\ No newline at end of file